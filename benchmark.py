@@ -0,0 +1,75 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Usage: python benchmark.py CYCLES VARIANT [VARIANT ...]
+#
+# Runs the agent on every configuration in the conf directory once per
+# variant and reports the time spent per run (the sum of the "wall time"
+# column of the log) and the speedup relative to the first variant. Wall time
+# rather than processor time is used, so that variants which run on several
+# threads are credited with their parallelism. A variant is a
+# comma-separated list of option assignments which override the
+# configuration file, e.g. "ct-log-table-size=0". Use "" for the unmodified
+# configuration.
+
+executable = os.environ.get("AIXI", os.path.join(".", "aixi"))
+
+def split(s):
+    return [x.strip() for x in s.split(",")]
+
+def write_conf(path, conf_file, cycles, variant):
+    # Later assignments in a configuration file override earlier ones.
+    out = open(path, "w")
+    out.write(open(conf_file).read())
+    out.write("\nterminate-age = %d\nverbose = 0\n" % cycles)
+    for assignment in split(variant):
+        if assignment:
+            out.write(assignment + "\n")
+    out.close()
+
+def run(conf_path, log_path):
+    subprocess.check_call([executable, conf_path, log_path],
+                          stdout=open(os.devnull, "w"))
+    lines = open(log_path).readlines()
+    labels = split(lines[0])
+    rows = [split(line) for line in lines[1:]]
+    time = sum(float(row[labels.index("wall time")]) for row in rows)
+    reward = float(rows[-1][labels.index("average reward")])
+    return time, reward
+
+def main(cycles, variants):
+    work_dir = tempfile.mkdtemp()
+    try:
+        print("%-24s" % "environment" +
+              "".join("%28s" % (v or "(default)") for v in variants))
+
+        totals = [0.0] * len(variants)
+        for conf in sorted(os.listdir("conf")):
+            conf_file = os.path.join("conf", conf)
+            results = []
+            for i, variant in enumerate(variants):
+                conf_path = os.path.join(work_dir, "%d-%s" % (i, conf))
+                write_conf(conf_path, conf_file, cycles, variant)
+                results.append(run(conf_path, conf_path + ".log"))
+                totals[i] += results[-1][0]
+
+            line = "%-24s" % os.path.splitext(conf)[0]
+            for time, reward in results:
+                speedup = results[0][0] / time if time > 0 else 0.0
+                line += "%13.2fs x%5.2f r=%6.3f" % (time, speedup, reward)
+            print(line)
+
+        print("%-24s" % "total" +
+              "".join("%13.2fs x%5.2f         " % (t, totals[0] / t if t else 0)
+                      for t in totals))
+    finally:
+        shutil.rmtree(work_dir)
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("usage: python benchmark.py CYCLES VARIANT [VARIANT ...]")
+        sys.exit(1)
+    main(int(sys.argv[1]), sys.argv[2:])
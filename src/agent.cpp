@@ -1,31 +1,155 @@
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
 #include <iostream>
 
 #include "agent.hpp"
 #include "predict.hpp"
 #include "search.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 
 // construct a learning agent from the command line arguments
 Agent::Agent(options_t &options, Environment const& env) :
-	m_options(options), m_env(env)
+	m_options(options), m_env(env), m_max_action(env.maxAction()),
+	m_action_bits(env.actionBits()), m_observation_bits(env.observationBits()),
+	m_reward_bits(env.rewardBits()), m_percept_bits(env.perceptBits())
 {
-	m_time_cycle = 1;
-
 	getRequiredOption(options, "agent-horizon", m_horizon);
 	getRequiredOption(options, "mc-simulations", m_mc_simulations);
 	getOption(options, "learning-period", 0, m_learning_period);
+	getOption(options, "ct-compact-interval", 0, m_compact_interval);
+	getOption(options, "ct-compact-after-learning", false,
+		m_compact_after_learning);
+	if (m_compact_interval < 0) {
+		std::cerr << "ERROR: ct-compact-interval must be nonnegative"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
 
-	// Create context tree
-	int ct_depth = getRequiredOption<int>(options, "ct-depth");
-	m_ct = new ContextTree(ct_depth);
+	// Create context tree. A search reverts at most a horizon's worth of
+	// cycles, plus the symbols of a prediction made at the deepest point.
+	int cycle_bits = m_action_bits + m_percept_bits;
+	m_ct = ContextTree::create(options, (m_horizon + 1) * cycle_bits,
+		m_percept_bits);
+
+	// Measure a reduced precision model against the same model in the
+	// standard format, and in the compact format, from which it differs only
+	// in rounding. All start empty. Pruning would cut each tree differently,
+	// so the model must not be pruned.
+	m_standard_copy.ct = NULL;
+	m_compact_copy.ct = NULL;
+	m_searching = false;
+	bool precision_check;
+	getOption(options, "ct-precision-check", false, precision_check);
+	if (precision_check) {
+		std::string format = getOption<std::string>(options,
+			"ct-node-format", "standard");
+		if (format != "compact-float" && format != "compact-fixed") {
+			std::cerr << "ERROR: ct-precision-check requires ct-node-format = "
+				<< "compact-float or compact-fixed" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (getOption<std::string>(options, "ct-backend", "arena") !=
+				"arena") {
+			std::cerr << "ERROR: ct-precision-check requires ct-backend = "
+				<< "arena" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (options.count("load-model") > 0) {
+			std::cerr << "ERROR: ct-precision-check cannot be used with "
+				<< "load-model" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (getOption<size_t>(options, "ct-max-nodes", 0) > 0 ||
+				getOption<size_t>(options, "ct-max-bytes", 0) > 0) {
+			std::cerr << "ERROR: ct-precision-check cannot be used with "
+				<< "ct-max-nodes or ct-max-bytes" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		options_t copy = options;
+		copy["ct-node-format"] = "standard";
+		m_standard_copy.ct = ContextTree::create(copy,
+			(m_horizon + 1) * cycle_bits, m_percept_bits);
+		copy["ct-node-format"] = "compact";
+		m_compact_copy.ct = ContextTree::create(copy,
+			(m_horizon + 1) * cycle_bits, m_percept_bits);
+	}
+	m_standard_copy.reset();
+	m_compact_copy.reset();
+	m_divergence_percepts = 0;
 
-	reset();
+	// Start afresh. The context tree is not cleared, as it may hold a saved
+	// model.
+	m_time_cycle = 0;
+	m_total_reward = 0.0;
+	m_last_update = action_update;
+	m_model_pruned = 0;
+	m_compact_time = 0.0;
+	m_path_cost_before = 0.0;
+	m_path_cost_after = 0.0;
+
+	// Create the search workers, each simulating on an overlay of the context
+	// tree with its own random numbers.
+	int search_threads;
+	getOption(options, "search-threads", 0, search_threads);
+	bool huge_pages;
+	getOption(options, "huge-pages", false, huge_pages);
+	unsigned int seed;
+	getOption(options, "random-seed", 0u, seed);
+	m_random_state = seedRandomState(seed, 0);
+	m_search_pool = NULL;
+	for (int i = 0; i < search_threads; i++) {
+		ContextTree *overlay = m_ct->createOverlay();
+		if (overlay == NULL) {
+			std::cerr << "ERROR: search-threads requires ct-model = single"
+				<< " and ct-backend = arena" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		m_search_workers.push_back(new Agent(*this, overlay));
+		m_search_workers.back()->m_search_tree = new SearchTree(huge_pages);
+		m_search_workers.back()->m_random_state = seedRandomState(seed, i);
+	}
+	if (search_threads > 0)
+		m_search_pool = new ThreadPool(search_threads);
+	m_search_tree = search_threads > 0 ? NULL : new SearchTree(huge_pages);
+}
+
+
+// create a search worker simulating on an overlay of the agent's model
+Agent::Agent(const Agent &agent, ContextTree *ct) :
+	m_options(agent.m_options), m_env(agent.m_env),
+	m_max_action(agent.m_max_action), m_action_bits(agent.m_action_bits),
+	m_observation_bits(agent.m_observation_bits),
+	m_reward_bits(agent.m_reward_bits), m_percept_bits(agent.m_percept_bits),
+	m_ct(ct),
+	m_time_cycle(agent.m_time_cycle), m_total_reward(agent.m_total_reward),
+	m_last_update(agent.m_last_update), m_horizon(agent.m_horizon),
+	m_mc_simulations(agent.m_mc_simulations), m_search_tree(NULL),
+	m_search_pool(NULL), m_learning_period(agent.m_learning_period),
+	m_model_pruned(0), m_compact_interval(0),
+	m_compact_after_learning(false), m_compact_time(0.0),
+	m_path_cost_before(0.0), m_path_cost_after(0.0), m_searching(false),
+	m_divergence_percepts(0)
+{
+	m_standard_copy.ct = NULL;
+	m_standard_copy.reset();
+	m_compact_copy.ct = NULL;
+	m_compact_copy.reset();
 }
 
 
 // destroy the agent and the corresponding context tree
 Agent::~Agent(void) {
+	for (size_t i = 0; i < m_search_workers.size(); i++) {
+		delete m_search_workers[i];
+	}
+	delete m_search_pool;
+	delete m_search_tree;
+	delete m_standard_copy.ct;
+	delete m_compact_copy.ct;
+
 	if (m_ct)
 		delete m_ct;
 }
@@ -63,17 +187,41 @@ int Agent::horizon(void) const {
 
 // maximum number of bits needed to represent action or percept
 int Agent::maxBitsNeeded() const {
-	return std::max(m_env.actionBits(), m_env.perceptBits());
+	return std::max(m_action_bits, m_percept_bits);
 }
 
 int Agent::modelSize() const {
 	return m_ct->size();
 }
 
+size_t Agent::modelBytes() const {
+	return m_ct->memoryUsage();
+}
+
+size_t Agent::modelNodeBytes() const {
+	return m_ct->nodeBytes();
+}
+
+size_t Agent::modelLevelSize(const int level) const {
+	return m_ct->levelSize(level);
+}
+
+size_t Agent::modelNodesCreated() const {
+	return m_ct->nodesCreated();
+}
+
+size_t Agent::modelNodesReleased() const {
+	return m_ct->nodesReleased();
+}
+
+bool Agent::saveModel(const std::string &path) const {
+	return m_ct->save(path);
+}
+
 
 // generate an action uniformly at random
 action_t Agent::genRandomAction(void) const {
-	return randRange(m_env.maxAction() + 1);
+	return randRange(m_max_action + 1);
 }
 
 
@@ -83,7 +231,7 @@ action_t Agent::genAction(void) const {
 
 	// sample from context tree
 	symbol_list_t action_syms;
-	m_ct->genRandomSymbols(action_syms, m_env.actionBits());
+	m_ct->genRandomSymbols(action_syms, m_action_bits);
 
 	// decode sample
 	return decodeAction(action_syms);
@@ -94,7 +242,7 @@ action_t Agent::genAction(void) const {
 void Agent::genPercept(percept_t &o, percept_t &r) {
 	// sample from context tree
 	symbol_list_t percept_syms;
-	m_ct->genRandomSymbols(percept_syms, m_env.perceptBits());
+	m_ct->genRandomSymbols(percept_syms, m_percept_bits);
 
 	decodePercept(percept_syms, o, r);
 }
@@ -105,7 +253,7 @@ void Agent::genPercept(percept_t &o, percept_t &r) {
 void Agent::genPerceptAndUpdate(percept_t &o, percept_t &r) {
 	// sample from context tree
 	symbol_list_t percept_syms;
-	m_ct->genRandomSymbolsAndUpdate(percept_syms, m_env.perceptBits());
+	m_ct->genRandomSymbolsAndUpdate(percept_syms, m_percept_bits);
 	decodePercept(percept_syms, o, r);
 
 	// Update other properties
@@ -121,10 +269,36 @@ void Agent::modelUpdate(percept_t observation, percept_t reward) {
 	// Update internal model
 	symbol_list_t percept_syms;
 	encodePercept(percept_syms, observation, reward);
-	if(m_learning_period > 0 && m_time_cycle > m_learning_period)
+	double log_before = m_ct->logBlockProbability();
+	bool learning = m_learning_period == 0 ||
+		m_time_cycle <= m_learning_period;
+	if (!learning)
 		m_ct->updateHistory(percept_syms); // Update but don't learn
 	else
 		m_ct->update(percept_syms); // Update and learn
+	if (checksPrecision()) updateCopies(percept_syms, log_before, learning);
+
+	// Keep the model within its memory budget. No search is running, so no
+	// overlay is in use and the update will not be reverted.
+	m_model_pruned = m_ct->prune();
+
+	// Lay the model out afresh every so often while it learns, and once
+	// more after the last update it learns from.
+	m_compact_time = 0.0;
+	m_path_cost_before = 0.0;
+	m_path_cost_after = 0.0;
+	bool compact = learning && m_compact_interval > 0 &&
+		(m_time_cycle + 1) % m_compact_interval == 0;
+	if (m_compact_after_learning && m_learning_period > 0 &&
+			m_time_cycle == m_learning_period)
+		compact = true;
+	if (compact) {
+		m_path_cost_before = m_ct->pathCost();
+		clock_t start = clock();
+		m_ct->compact();
+		m_compact_time = double(clock() - start) / double(CLOCKS_PER_SEC);
+		m_path_cost_after = m_ct->pathCost();
+	}
 
 	// Update other properties
 	m_total_reward += reward;
@@ -140,12 +314,66 @@ void Agent::modelUpdate(const action_t action) {
 	symbol_list_t action_syms;
 	encodeAction(action_syms, action);
 	m_ct->updateHistory(action_syms);
+	if (checksPrecision() && !m_searching) {
+		m_standard_copy.ct->updateHistory(action_syms);
+		m_compact_copy.ct->updateHistory(action_syms);
+	}
 
 	m_time_cycle++;
 	m_last_update = action_update;
 }
 
 
+// The probability each model gave the percept is the ratio of its block
+// probabilities after and before it. A percept only added to the history is
+// not predicted. Nor is one on which the model halved its counts: the ratio
+// then reflects the halving, and may exceed one or overflow.
+void Agent::updateCopies(const symbol_list_t &percept_syms,
+		const double log_before, const bool learn) {
+	double predicted = std::exp(m_ct->logBlockProbability() - log_before);
+	bool measure = learn && predicted <= 1.0;
+	m_standard_copy.update(percept_syms, predicted, learn, measure);
+	m_compact_copy.update(percept_syms, predicted, learn, measure);
+	if (measure) m_divergence_percepts++;
+}
+
+
+void Agent::ModelCopy::update(const symbol_list_t &percept_syms,
+		const double predicted, const bool learn, const bool measure) {
+	double log_before = ct->logBlockProbability();
+	if (learn)
+		ct->update(percept_syms);
+	else
+		ct->updateHistory(percept_syms);
+	divergence = 0.0;
+	if (!measure) return;
+	double copy = std::exp(ct->logBlockProbability() - log_before);
+	divergence = std::fabs(predicted - copy);
+	divergence_max = std::max(divergence_max, divergence);
+	divergence_sum += divergence;
+}
+
+
+void Agent::ModelCopy::reset(void) {
+	if (ct) ct->clear();
+	divergence = 0.0;
+	divergence_max = 0.0;
+	divergence_sum = 0.0;
+}
+
+
+double Agent::modelDivergenceMean() const {
+	if (m_divergence_percepts == 0) return 0.0;
+	return m_standard_copy.divergence_sum / double(m_divergence_percepts);
+}
+
+
+double Agent::roundingDivergenceMean() const {
+	if (m_divergence_percepts == 0) return 0.0;
+	return m_compact_copy.divergence_sum / double(m_divergence_percepts);
+}
+
+
 // revert the agent's internal model of the world
 // to that of a previous time cycle
 void Agent::modelRevert(const ModelUndo &mu) {
@@ -154,10 +382,10 @@ void Agent::modelRevert(const ModelUndo &mu) {
 	while (historySize() > mu.historySize()) {
 
 		if(m_last_update == percept_update) { // Undo percept
-			m_ct->revert(m_env.perceptBits());
+			m_ct->revert(m_percept_bits);
 			m_last_update = action_update;
 		} else {                              // Undo action
-			m_ct->revertHistory(m_env.actionBits());
+			m_ct->revertHistory(m_action_bits);
 			m_last_update = percept_update;
 		}
 	}
@@ -171,9 +399,16 @@ void Agent::modelRevert(const ModelUndo &mu) {
 
 void Agent::reset(void) {
 	m_ct->clear();
+	m_standard_copy.reset();
+	m_compact_copy.reset();
+	m_divergence_percepts = 0;
 	m_time_cycle = 0;
 	m_total_reward = 0.0;
 	m_last_update = action_update;
+	m_model_pruned = 0;
+	m_compact_time = 0.0;
+	m_path_cost_before = 0.0;
+	m_path_cost_after = 0.0;
 }
 
 
@@ -206,43 +441,115 @@ double Agent::perceptProbability(const percept_t observation, const percept_t re
 }
 
 
+// get the agent's probability of receiving every percept, or the most
+// probable ones
+void Agent::perceptDistribution(std::vector<PerceptPrediction> &percepts,
+		const size_t limit) const {
+	assert(m_last_update == action_update);
+	assert(limit > 0 || m_percept_bits <= ContextTree::cMaxSequenceBits);
+
+	std::vector<SequencePrediction> sequences;
+	m_ct->predictSequences(m_percept_bits, sequences, limit);
+
+	// A percept is encoded as the reward followed by the observation, each
+	// least significant bit first, so the reward is in the low bits.
+	const uint32_t reward_mask = (uint32_t(1) << m_reward_bits) - 1;
+	percepts.resize(sequences.size());
+	for (size_t i = 0; i < sequences.size(); i++) {
+		percepts[i].reward = sequences[i].sequence & reward_mask;
+		percepts[i].observation = sequences[i].sequence >> m_reward_bits;
+		percepts[i].probability = sequences[i].probability;
+	}
+}
+
+
 // Use rhoUCT to search for next action.
 action_t Agent::search(void) {
-	// Save the agent's current state
+	// Save the agent's current state. The actions simulated from it are not
+	// taken.
 	ModelUndo undo = ModelUndo(*this);
-
-	// Create a new search tree
-	m_search_tree = new SearchNode(decision);
-
+	m_searching = true;
+
+	// Start a new search tree for the agent or for each worker. Clearing a
+	// tree releases the last search's nodes all at once.
+	std::vector<SearchTree *> trees;
+	if (m_search_workers.empty()) {
+		trees.push_back(m_search_tree);
+	} else {
+		for (size_t i = 0; i < m_search_workers.size(); i++) {
+			trees.push_back(m_search_workers[i]->m_search_tree);
+		}
+	}
+	for (size_t i = 0; i < trees.size(); i++) {
+		trees[i]->clear();
+	}
 
 	// Main sampling loop
-	for (int t = 0; t < m_mc_simulations; t++) {
-		m_search_tree->sample(*this, m_horizon);
-		modelRevert(undo);
+	if (m_search_workers.empty()) {
+		for (int t = 0; t < m_mc_simulations; t++) {
+			m_search_tree->root().sample(*this, *m_search_tree, m_horizon);
+			modelRevert(undo);
+		}
+	} else {
+		m_search_pool->run(searchTask, this, int(m_search_workers.size()));
 	}
+	m_searching = false;
 
 	// Determine best action using tree constructed during sampling
 	// by choosing the action branch from this tree that provides the best expected reward.
+	// The workers' estimates are combined in proportion to their visits.
 	action_t best_action = genRandomAction();
 	double best_mean = -1;
 
 	for (action_t a = 0; a <= maxAction(); a++) {
-		if (!m_search_tree->child(a))
+		double total = 0.0;
+		visits_t visits = 0;
+		for (size_t i = 0; i < trees.size(); i++) {
+			const SearchNode *n = trees[i]->child(trees[i]->root(), a);
+			if (n) {
+				total += n->expectation() * n->visits();
+				visits += n->visits();
+			}
+		}
+		if (visits == 0)
 			continue;
 
-		double mean = m_search_tree->child(a)->expectation() + rand01() * 0.0001;
+		double expectation = trees.size() == 1 ?
+			trees[0]->child(trees[0]->root(), a)->expectation() :
+			total / visits;
+		double mean = expectation + rand01() * 0.0001;
 		if (mean > best_mean) {
 			best_mean = mean;
 			best_action = a;
 		}
 	}
 
-	delete m_search_tree;
-
 	return best_action;
 }
 
 
+// Run every search-threads'th simulation on a worker. Each simulation starts
+// from the agent's current state: the overlay is cleared and the worker's
+// attributes are restored. The first worker draws from rand(), as a search
+// without workers does, and the others from their own generators, so that no
+// two threads share one and a seeded run can be repeated.
+void Agent::searchTask(void *context, const int index) {
+	const Agent *agent = static_cast<const Agent *>(context);
+	Agent *worker = agent->m_search_workers[index];
+	ModelUndo undo = ModelUndo(*agent);
+
+	useRandomState(index == 0 ? NULL : &worker->m_random_state);
+	int workers = int(agent->m_search_workers.size());
+	for (int t = index; t < agent->m_mc_simulations; t += workers) {
+		worker->m_ct->clear();
+		worker->modelRevert(undo);
+		worker->m_search_tree->root().sample(*worker, *worker->m_search_tree,
+			worker->m_horizon);
+	}
+	useRandomState(NULL);
+}
+
+
 // Agent's playout policy. Generate percepts from context tree and choose
 // actions uniformly at random.
 reward_t Agent::playout(int horizon) {
@@ -266,7 +573,7 @@ reward_t Agent::playout(int horizon) {
 // Encodes an action as a list of symbols
 void Agent::encodeAction(symbol_list_t &symbols, action_t action) const {
 	symbols.clear();
-	encode(symbols, action, m_env.actionBits());
+	encode(symbols, action, m_action_bits);
 }
 
 
@@ -275,27 +582,27 @@ void Agent::encodePercept(symbol_list_t &symlist, percept_t observation,
 		percept_t reward) const {
 	symlist.clear();
 
-	encode(symlist, reward, m_env.rewardBits());
-	encode(symlist, observation, m_env.observationBits());
+	encode(symlist, reward, m_reward_bits);
+	encode(symlist, observation, m_observation_bits);
 }
 
 
 // Decodes the action from a list of symbols
 // When m_actions doesn't fill bits, just wrap around
 action_t Agent::decodeAction(const symbol_list_t &symlist) const {
-	return decode(symlist, m_env.actionBits()) % (m_env.maxAction() + 1);
+	return decode(symlist, m_action_bits) % (m_max_action + 1);
 }
 
 
 // Decodes the observation from a list of symbols
 percept_t Agent::decodeObservation(const symbol_list_t &symlist) const {
-	return decode(symlist, m_env.observationBits());
+	return decode(symlist, m_observation_bits);
 }
 
 
 // Decodes the reward from a list of symbols
 percept_t Agent::decodeReward(const symbol_list_t &symlist) const {
-	return decode(symlist, m_env.rewardBits());
+	return decode(symlist, m_reward_bits);
 }
 
 
@@ -303,12 +610,12 @@ percept_t Agent::decodeReward(const symbol_list_t &symlist) const {
 void Agent::decodePercept(const symbol_list_t &symlist, percept_t &observation,
 		                  percept_t &reward) {
 
-	symbol_list_t reward_syms = symbol_list_t(m_env.rewardBits());
-	copy(symlist.begin(), symlist.begin() + m_env.rewardBits(),
+	symbol_list_t reward_syms = symbol_list_t(m_reward_bits);
+	copy(symlist.begin(), symlist.begin() + m_reward_bits,
 	     reward_syms.begin());
 
-	symbol_list_t observation_syms = symbol_list_t(m_env.observationBits());
-	copy(symlist.begin() + m_env.rewardBits(), symlist.end(),
+	symbol_list_t observation_syms = symbol_list_t(m_observation_bits);
+	copy(symlist.begin() + m_reward_bits, symlist.end(),
 	     observation_syms.begin());
 
 	reward = decodeReward(reward_syms);
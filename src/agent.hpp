@@ -5,15 +5,26 @@
 //#include <queue>
 #include "environment.hpp"
 #include "main.hpp"
+#include "util.hpp"
 
 class ContextTree;
 
-class SearchNode;
+class SearchTree;
 
 class ModelUndo;
 
+class ThreadPool;
+
 enum update_t {action_update, percept_update};
 
+/** A percept and the probability the agent's model gives it (see
+ * Agent::perceptDistribution()). */
+struct PerceptPrediction {
+	percept_t observation;
+	percept_t reward;
+	double probability;
+};
+
 /** The ::Agent class represents a MC-AIXI-CTW agent.  It includes much of the
  * high-level logic for choosing suitable actions. In particular, the agent
  * maintains an internal model of the environment using a context tree
@@ -21,6 +32,7 @@ enum update_t {action_update, percept_update};
  * future outcomes:
  *  - Agent::getPredictedActionProb()
  *  - Agent::perceptProbability()
+ *  - Agent::perceptDistribution()
  *
  * as well as to generate actions and percepts according to the model
  * distribution:
@@ -36,6 +48,7 @@ enum update_t {action_update, percept_update};
  *  - Agent::m_horizon
  *  - Agent::m_mc_simulations
  *  - Agent::m_search_tree
+ *  - Agent::m_search_workers
  *
  * Several functions decode/encode actions and percepts between the
  * corresponding types (i.e. ::action_t, ::percept_t) and generic
@@ -101,6 +114,66 @@ public:
 
 	int modelSize() const;
 
+	/** The number of bytes of memory held by the agent's model. */
+	size_t modelBytes() const;
+
+	/** The number of bytes of memory used by the nodes of the agent's model
+	 * (see ContextTree::nodeBytes()). */
+	size_t modelNodeBytes() const;
+
+	/** The number of nodes at a depth of the agent's model, where the root
+	 * is at depth 0 (see ContextTree::levelSize()). */
+	size_t modelLevelSize(const int level) const;
+
+	/** The number of nodes the agent's model has created and released since
+	 * it was made. Both are running totals, kept as the model changes. */
+	size_t modelNodesCreated() const;
+	size_t modelNodesReleased() const;
+
+	/** The number of context tree nodes pruned to keep the model within its
+	 * budget when the last percept was added (see ContextTree::prune()). */
+	size_t modelPruned() const { return m_model_pruned; }
+
+	/** The time in seconds spent compacting the agent's model when the last
+	 * percept was added, or 0 if it was not compacted (see
+	 * ContextTree::compact()). */
+	double compactTime() const { return m_compact_time; }
+
+	/** The path-walk cost of the agent's model (ContextTree::pathCost())
+	 * before and after it was last compacted, or 0 if it was not compacted
+	 * when the last percept was added. */
+	double pathCostBefore() const { return m_path_cost_before; }
+	double pathCostAfter() const { return m_path_cost_after; }
+
+	/** Whether the agent keeps double precision copies of a reduced
+	 * precision model, to measure how far its predictions drift (the
+	 * "ct-precision-check" option). */
+	bool checksPrecision() const { return m_standard_copy.ct != NULL; }
+
+	/** The absolute difference between the probabilities the agent's model
+	 * and its copy in the standard format gave the last percept, and the mean
+	 * and largest difference over every percept learned from, except those on
+	 * which the model halved its counts. All are 0 unless
+	 * Agent::checksPrecision(). */
+	double modelDivergence() const { return m_standard_copy.divergence; }
+	double modelDivergenceMean() const;
+	double modelDivergenceMax() const { return m_standard_copy.divergence_max; }
+
+	/** As Agent::modelDivergence(), against the copy in the compact format.
+	 * Its counts are halved as the model's are, so this measures only the
+	 * rounding of the weighted probabilities. */
+	double roundingDivergence() const { return m_compact_copy.divergence; }
+	double roundingDivergenceMean() const;
+	double roundingDivergenceMax() const {
+		return m_compact_copy.divergence_max;
+	}
+
+	/** Save the agent's model of the environment, so that a later run can
+	 * start from it with the "load-model" option (see ContextTree::save()).
+	 * \param path The file to write.
+	 * \return True on success. */
+	bool saveModel(const std::string &path) const;
+
 	/** Generate an action uniformly at random.
 	 * \return The generated action. */
 	action_t genRandomAction() const;
@@ -155,6 +228,22 @@ public:
 	 * \returns The probability of observing the (observation, reward) pair. */
 	double perceptProbability(percept_t observation, percept_t reward) const;
 
+	/** The probability of every percept according to the agent's environment
+	 * model, or of the most probable ones. This shares the work for percepts
+	 * which begin with the same symbols (see ContextTree::predictSequences()),
+	 * so it is much cheaper than calling Agent::perceptProbability() for each.
+	 * The model gives some probability to every code the percept bits can
+	 * hold, including those beyond the environment's maximum observation and
+	 * reward, so these are listed too.
+	 * \param percepts Receives every percept, ordered by observation and then
+	 * by reward, or with a limit the most probable percepts, most probable
+	 * first.
+	 * \param limit The number of most probable percepts wanted, or 0 for all
+	 * of them. A percept of more than ContextTree::cMaxSequenceBits bits needs
+	 * a limit. */
+	void perceptDistribution(std::vector<PerceptPrediction> &percepts,
+		const size_t limit = 0) const;
+
 	/** Determine the best action for the agent using Monte-Carlo Tree Search
 	 * (predictive UCT).
 	 * \return The best action as determined by the sampling. */
@@ -171,6 +260,27 @@ public:
 private:
 
 
+	/** Create a worker for a parallel search: a copy of an agent which
+	 * simulates on an overlay of its context tree.
+	 * \param agent The agent doing the search.
+	 * \param ct The overlay, which the worker takes ownership of. */
+	Agent(const Agent &agent, ContextTree *ct);
+
+	/** Run the share of the simulations of a search given to a worker. A
+	 * ThreadPool::task_t.
+	 * \param context The agent doing the search.
+	 * \param index The index of the worker in Agent::m_search_workers. */
+	static void searchTask(void *context, const int index);
+
+	/** Add a percept to the copies of the model as it was added to the
+	 * model, and measure the divergence of their predictions of it.
+	 * \param percept_syms The percept.
+	 * \param log_before The model's ContextTree::logBlockProbability()
+	 * before the percept was added.
+	 * \param learn False if the percept was only added to the history. */
+	void updateCopies(const symbol_list_t &percept_syms,
+		const double log_before, const bool learn);
+
 	/** Encode an action as a list of symbols.
 	 * \param symlist The symbol list to encode the action to.
 	 * \param action The action to encode. */
@@ -211,6 +321,16 @@ private:
 	/** A reference to the environment the agent interacts with. */
 	Environment const& m_env;
 
+	/** The environment's Environment::maxAction() and numbers of bits, which
+	 * are fixed for its lifetime. They are read for every symbol the search
+	 * encodes or decodes, so they are kept here rather than recomputed
+	 * through virtual calls. */
+	action_t m_max_action;
+	int m_action_bits;
+	int m_observation_bits;
+	int m_reward_bits;
+	int m_percept_bits;
+
 	/** Context tree representing the agent's model of the environment. */
 	ContextTree *m_ct;
 
@@ -230,11 +350,82 @@ private:
 	 * UCT algorithm. */
 	int m_mc_simulations;
 
-	/** The root node of the UCT search tree. */
-	SearchNode *m_search_tree;
+	/** The UCT search tree, which is cleared at the start of each search. NULL
+	 * if the agent searches with Agent::m_search_workers. */
+	SearchTree *m_search_tree;
+
+	/** Agents which search in parallel, each on its own overlay of the
+	 * context tree (ContextTree::createOverlay()) and with its own search
+	 * tree. Empty if the agent searches by updating and reverting its own
+	 * context tree. */
+	std::vector<Agent *> m_search_workers;
+
+	/** Runs the workers in Agent::m_search_workers. */
+	ThreadPool *m_search_pool;
+
+	/** The random number generator of a search worker other than the first,
+	 * seeded from the "random-seed" option and the worker's index (see
+	 * Agent::searchTask()). */
+	random_state_t m_random_state;
 
 	/** The number of cycles during which the agent learns. */
 	int m_learning_period;
+
+	/** See Agent::modelPruned(). */
+	size_t m_model_pruned;
+
+	/** The number of cycles between compactions of the model while it
+	 * learns, or 0 to compact it only as Agent::m_compact_after_learning
+	 * asks. */
+	int m_compact_interval;
+
+	/** True to compact the model once the learning period ends. */
+	bool m_compact_after_learning;
+
+	/** See Agent::compactTime(). */
+	double m_compact_time;
+
+	/** See Agent::pathCostBefore(). */
+	double m_path_cost_before;
+	double m_path_cost_after;
+
+	/** A copy of the agent's model in another node format, and how far the
+	 * model's predictions have drifted from it. */
+	struct ModelCopy {
+		/** The copy. It learns the percepts received, and its history
+		 * follows the actions taken, but not those simulated by a search.
+		 * NULL unless Agent::checksPrecision(). */
+		ContextTree *ct;
+
+		/** See Agent::modelDivergence(). */
+		double divergence;
+		double divergence_max;
+		double divergence_sum;
+
+		/** Add a percept as it was added to the model.
+		 * \param percept_syms The percept.
+		 * \param predicted The probability the model gave the percept.
+		 * \param learn False if the percept was only added to the
+		 * history.
+		 * \param measure Whether to measure the divergence. */
+		void update(const symbol_list_t &percept_syms, const double predicted,
+			const bool learn, const bool measure);
+
+		/** Clear the copy and the divergence. */
+		void reset(void);
+	};
+
+	/** The model in the standard format, and in the compact format. */
+	ModelCopy m_standard_copy;
+	ModelCopy m_compact_copy;
+
+	/** Whether Agent::search() is simulating, so that the actions passed to
+	 * Agent::modelUpdate() are not taken. */
+	bool m_searching;
+
+	/** The number of percepts whose divergence was measured, for the mean
+	 * divergence. */
+	age_t m_divergence_percepts;
 };
 
 
@@ -0,0 +1,217 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <cassert>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <stdint.h>
+#include "pages.hpp"
+
+/** Identifies an object stored in an ::Arena. Indices are 32 bits wide so that
+ * structures linking objects by index (e.g. the children of a ::CTNode) are
+ * half the size of the equivalent pointers. */
+typedef uint32_t arena_index_t;
+
+/** The index that never refers to an object (the arena equivalent of NULL). */
+static const arena_index_t null_index = 0;
+
+
+/** An ::Arena owns a collection of objects of type T and hands out 32-bit
+ * indices to them. Objects are stored in fixed-size slabs which are never
+ * moved or freed until the arena is destroyed, so a reference to an object
+ * remains valid for as long as the object is allocated.
+ *
+ * Released objects are kept on a free list and handed out again by
+ * Arena::allocate(). Once the arena has grown to its working size, allocating
+ * and releasing objects is therefore a constant time operation which does not
+ * touch the heap.
+ *
+ * An arena can also adopt objects stored elsewhere, such as a memory-mapped
+ * file (Arena::attach()).
+ *
+ * The slabs are allocated with allocatePages(), on huge pages if
+ * Arena::useHugePages() asks for them.
+ *
+ * Slot ::null_index is reserved and never handed out. */
+template <class T>
+class Arena {
+public:
+
+	/** Create an empty arena. No slabs are allocated until the first call to
+	 * Arena::allocate(). */
+	Arena(void) : m_borrowed(0), m_next(1), m_size(0), m_huge_pages(false) { }
+
+
+	/** Destroy the arena and every object in it. Adopted objects are left to
+	 * their owner. */
+	~Arena(void) {
+		for (size_t i = m_borrowed; i < m_slabs.size(); i++) {
+			releaseSlab(m_slabs[i]);
+		}
+	}
+
+
+	/** Choose whether the slabs of an arena which has no slabs yet are
+	 * allocated on huge pages (see allocatePages()).
+	 * \param huge True to ask for huge pages. */
+	void useHugePages(const bool huge) {
+		assert(m_slabs.empty());
+		m_huge_pages = huge;
+	}
+
+
+	/** \return True if the arena asks for huge pages. */
+	bool hugePages(void) const { return m_huge_pages; }
+
+
+	/** Adopt an array of objects as the contents of an arena which has never
+	 * allocated. Object i of the array becomes object i of the arena, and
+	 * every object but ::null_index is allocated. Each whole slab's worth of
+	 * objects is used in place, and stays owned by the caller; the remainder
+	 * is copied into a slab of the arena's own.
+	 * \param objects The objects. They must outlive the arena.
+	 * \param count The number of objects in the array, including the unused
+	 * object at ::null_index. */
+	void attach(T *objects, const size_t count) {
+		assert(m_slabs.empty() && count > 0);
+		assert(count - 1 <= arena_index_t(~null_index));
+		m_borrowed = count / cSlabSize;
+		for (size_t i = 0; i < m_borrowed; i++) {
+			m_slabs.push_back(objects + i * cSlabSize);
+		}
+		if (count % cSlabSize != 0) {
+			T *slab = newSlab();
+			for (size_t i = 0; i < count % cSlabSize; i++) {
+				slab[i] = objects[m_borrowed * cSlabSize + i];
+			}
+			m_slabs.push_back(slab);
+		}
+		m_next = arena_index_t(count);
+		m_size = count - 1;
+	}
+
+
+	/** Allocate an object, reusing a released slot if there is one.
+	 * \return The index of a default-initialised object. */
+	arena_index_t allocate(void) {
+		arena_index_t index;
+		if (!m_free.empty()) {
+			index = m_free.back();
+			m_free.pop_back();
+		} else {
+			assert(m_next != null_index); // 2^32 objects exhausted
+			index = m_next++;
+			if ((index >> cSlabBits) >= m_slabs.size())
+				m_slabs.push_back(newSlab());
+		}
+		(*this)[index] = T();
+		m_size++;
+		return index;
+	}
+
+
+	/** Return an object to the free list. The object is not destroyed
+	 * until its slot is reused or the arena is destroyed.
+	 * \param index The index of the object to release. */
+	void release(const arena_index_t index) {
+		assert(index != null_index && index < m_next);
+		m_free.push_back(index);
+		m_size--;
+	}
+
+
+	/** Release every object in the arena. The slabs are kept for reuse. */
+	void clear(void) {
+		m_free.clear();
+		m_next = 1;
+		m_size = 0;
+	}
+
+
+	/** Exchange the objects, slabs and free lists of two arenas.
+	 * \param other The arena to exchange with. */
+	void swap(Arena &other) {
+		m_slabs.swap(other.m_slabs);
+		std::swap(m_borrowed, other.m_borrowed);
+		m_free.swap(other.m_free);
+		std::swap(m_next, other.m_next);
+		std::swap(m_size, other.m_size);
+		std::swap(m_huge_pages, other.m_huge_pages);
+	}
+
+
+	/** Access an allocated object. */
+	T &operator[](const arena_index_t index) {
+		return m_slabs[index >> cSlabBits][index & (cSlabSize - 1)];
+	}
+
+
+	/** Access an allocated object. */
+	const T &operator[](const arena_index_t index) const {
+		return m_slabs[index >> cSlabBits][index & (cSlabSize - 1)];
+	}
+
+
+	/** \return The number of objects currently allocated. */
+	size_t size(void) const { return m_size; }
+
+
+	/** \return The number of objects the arena can hold without allocating
+	 * another slab. */
+	size_t capacity(void) const { return m_slabs.size() * cSlabSize - 1; }
+
+private:
+
+	/** \return A new slab of default-initialised objects. */
+	T *newSlab(void) {
+		T *slab = static_cast<T *>(allocatePages(cSlabSize * sizeof(T),
+			m_huge_pages));
+		for (size_t i = 0; i < cSlabSize; i++) {
+			new (slab + i) T();
+		}
+		return slab;
+	}
+
+
+	/** Destroy the objects of a slab and free it. */
+	void releaseSlab(T *slab) {
+		for (size_t i = 0; i < cSlabSize; i++) {
+			slab[i].~T();
+		}
+		releasePages(slab, cSlabSize * sizeof(T), m_huge_pages);
+	}
+
+	/** Each slab holds 2^Arena::cSlabBits objects. */
+	static const unsigned int cSlabBits = 16;
+
+	/** The number of objects in each slab. */
+	static const size_t cSlabSize = size_t(1) << cSlabBits;
+
+	/** The slabs holding the objects. Object i lives in slab
+	 * i >> Arena::cSlabBits. */
+	std::vector<T *> m_slabs;
+
+	/** The number of leading slabs adopted by Arena::attach(), which the
+	 * arena does not own. */
+	size_t m_borrowed;
+
+	/** Indices of released objects, available for reuse. */
+	std::vector<arena_index_t> m_free;
+
+	/** The lowest index which has never been handed out. */
+	arena_index_t m_next;
+
+	/** The number of objects currently allocated. */
+	size_t m_size;
+
+	/** True if the slabs are allocated on huge pages. */
+	bool m_huge_pages;
+
+	// Arenas own their slabs and cannot be copied.
+	Arena(const Arena &);
+	Arena &operator=(const Arena &);
+};
+
+#endif // __ARENA_HPP__
@@ -0,0 +1,229 @@
+#ifndef __HISTORY_HPP__
+#define __HISTORY_HPP__
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+#include "main.hpp"
+
+/** A ::History stores the agent's history as a sequence of symbols packed into
+ * 64-bit words. Only the most recent symbols are kept: the words form a ring
+ * buffer and each new symbol overwrites the oldest once the buffer is full, so
+ * the memory used does not grow with the length of the history.
+ *
+ * The total number of symbols ever appended (less those removed) is still
+ * tracked by History::size(), but only the most recent History::capacity()
+ * symbols can be read or removed.
+ *
+ * Within each word the symbol at position p is stored at bit 63 - (p mod 64),
+ * so that History::recent() can extract a run of recent symbols, most recent
+ * first, with two shifts.
+ *
+ * The context of the next symbol, which a context tree reads through
+ * History::context() and History::contextSymbol(), is the most recent symbols
+ * in order unless History::selectContext() has chosen other ones. */
+class History {
+public:
+
+	/** Create an empty history.
+	 * \param retain The number of recent symbols which must be kept. The
+	 * capacity is rounded up to a power of two words. */
+	History(const size_t retain) :
+		m_size(0), m_oldest(0), m_span(0), m_revision(0) {
+		size_t words = 2;
+		while (words * cWordBits < retain + cWordBits) words *= 2;
+		m_words.resize(words, 0);
+		m_mask = words - 1;
+	}
+
+
+	/** Append a symbol, overwriting the oldest stored symbol if the buffer is
+	 * full. */
+	void push_back(const symbol_t symbol) {
+		uint64_t &word = m_words[(m_size / cWordBits) & m_mask];
+		uint64_t bit = uint64_t(1) << (cWordBits - 1 - m_size % cWordBits);
+		word = symbol ? (word | bit) : (word & ~bit);
+		m_size++;
+		m_revision++;
+		if (m_size - m_oldest > capacity()) m_oldest = m_size - capacity();
+		gatherContext();
+	}
+
+
+	/** Remove the most recent symbol. */
+	void pop_back(void) {
+		assert(m_size > m_oldest); // symbol no longer stored
+		m_size--;
+		m_revision++;
+		gatherContext();
+	}
+
+
+	/** Remove the most recent symbols until the history has the given size. */
+	void resize(const size_t size) {
+		assert(size <= m_size && size >= m_oldest);
+		m_size = size;
+		m_revision++;
+		gatherContext();
+	}
+
+
+	/** Remove every symbol. */
+	void clear(void) {
+		m_size = 0;
+		m_oldest = 0;
+		m_revision++;
+	}
+
+
+	/** \return The most recent symbol. */
+	symbol_t back(void) const {
+		assert(m_size > m_oldest);
+		return (recent(0) & 1) != 0;
+	}
+
+
+	/** Extract up to 64 consecutive symbols.
+	 * \param age The number of more recent symbols to skip.
+	 * \return A word whose bit j is the symbol appended age + j symbols before
+	 * the most recent one. Bits referring to symbols which are no longer
+	 * stored, or which precede the start of the history, are unspecified. */
+	uint64_t recent(const size_t age) const {
+		size_t last = m_size - 1 - age;
+		size_t offset = last % cWordBits;
+		uint64_t word = m_words[(last / cWordBits) & m_mask];
+		if (offset == cWordBits - 1) return word;
+		uint64_t previous = m_words[(last / cWordBits - 1) & m_mask];
+		return (word >> (cWordBits - 1 - offset)) | (previous << (offset + 1));
+	}
+
+
+	/** Build the context from chosen symbols of the history rather than the
+	 * most recent ones. The buffer grows so that the oldest symbol chosen is
+	 * kept as well as the number of symbols the history was created to keep.
+	 * \param ages The age of the symbol at each position of the context,
+	 * where age 0 is the most recent symbol. The history must be empty. */
+	void selectContext(const std::vector<size_t> &ages) {
+		assert(m_size == 0 && !ages.empty());
+		m_span = *std::max_element(ages.begin(), ages.end()) + 1;
+		size_t extra = m_span > ages.size() ? m_span - ages.size() : 0;
+		size_t words = m_words.size();
+		while (words * cWordBits < capacity() + extra) words *= 2;
+		m_words.assign(words, 0);
+		m_mask = words - 1;
+
+		// Split the ages into runs which one call to History::recent() reads.
+		m_runs.clear();
+		for (size_t position = 0; position < ages.size(); position++) {
+			if (m_runs.empty() || ages[position] != m_runs.back().age +
+					m_runs.back().length || m_runs.back().length == cWordBits) {
+				ContextRun run = { position, ages[position], 0 };
+				m_runs.push_back(run);
+			}
+			m_runs.back().length++;
+		}
+		m_context.assign(ages.size() / cWordBits + 2, 0);
+		m_revision++;
+	}
+
+
+	/** \return The symbol at a position of the context, which selects the
+	 * child at depth position + 1 of a context tree.
+	 * \param position The position; 0 is the first symbol of the context. */
+	symbol_t contextSymbol(const size_t position) const {
+		if (m_runs.empty()) return (recent(position) & 1) != 0;
+		return ((m_context[position / cWordBits] >>
+			(position % cWordBits)) & 1) != 0;
+	}
+
+
+	/** Extract up to 64 consecutive symbols of the context.
+	 * \param position The position of the first symbol.
+	 * \return A word whose bit j is the symbol at position + j of the
+	 * context. Bits past the end of a selected context are zero. */
+	uint64_t context(const size_t position) const {
+		if (m_runs.empty()) return recent(position);
+		size_t offset = position % cWordBits;
+		const uint64_t *word = &m_context[position / cWordBits];
+		if (offset == 0) return word[0];
+		return (word[0] >> offset) | (word[1] << (cWordBits - offset));
+	}
+
+
+	/** \return The number of symbols in the history, including those no
+	 * longer stored. */
+	size_t size(void) const { return m_size; }
+
+
+	/** \return The number of recent symbols that are stored. */
+	size_t capacity(void) const { return m_words.size() * cWordBits; }
+
+
+	/** \return A number which changes whenever a symbol is added or removed,
+	 * and is kept by copies, so that a copy can tell whether the history it
+	 * was copied from has changed since. */
+	size_t revision(void) const { return m_revision; }
+
+private:
+
+	/** Copy the selected symbols of the context into History::m_context,
+	 * once there are enough symbols. Updates of a context tree read the
+	 * context many times for each symbol they append. */
+	void gatherContext(void) {
+		if (m_runs.empty() || m_size < m_span) return;
+		std::fill(m_context.begin(), m_context.end(), 0);
+		for (size_t i = 0; i < m_runs.size(); i++) {
+			const ContextRun &run = m_runs[i];
+			uint64_t bits = recent(run.age);
+			if (run.length < cWordBits) bits &= (uint64_t(1) << run.length) - 1;
+			size_t offset = run.position % cWordBits;
+			m_context[run.position / cWordBits] |= bits << offset;
+			if (offset > 0) {
+				m_context[run.position / cWordBits + 1] |=
+					bits >> (cWordBits - offset);
+			}
+		}
+	}
+
+	/** The number of symbols packed into each word. */
+	static const size_t cWordBits = 64;
+
+	/** Consecutive positions of the context which hold consecutive symbols
+	 * of the history: ContextRun::length positions from ContextRun::position
+	 * hold the symbols from age ContextRun::age back. */
+	struct ContextRun {
+		size_t position;
+		size_t age;
+		size_t length;
+	};
+
+	/** The ring buffer. Symbol p lives in word (p / 64) & History::m_mask. */
+	std::vector<uint64_t> m_words;
+
+	/** The number of words in the ring buffer, less one. */
+	size_t m_mask;
+
+	/** The number of symbols in the history. */
+	size_t m_size;
+
+	/** The position of the oldest symbol which is still stored. */
+	size_t m_oldest;
+
+	/** The runs of the context chosen by History::selectContext(), or none
+	 * if the context is the most recent symbols. */
+	std::vector<ContextRun> m_runs;
+
+	/** The number of symbols needed to give the chosen context. */
+	size_t m_span;
+
+	/** The chosen context, gathered by History::gatherContext(): position p
+	 * is bit p % 64 of word p / 64. A word of zeros follows the context. */
+	std::vector<uint64_t> m_context;
+
+	/** See History::revision(). */
+	size_t m_revision;
+};
+
+#endif // __HISTORY_HPP__
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -9,6 +10,7 @@
 #include "agent.hpp"
 #include "environment.hpp"
 #include "main.hpp"
+#include "pages.hpp"
 #include "search.hpp"
 #include "util.hpp"
 
@@ -61,6 +63,11 @@ void mainLoop(Agent &ai, Environment &env, options_t &options) {
 	int learning_period = getOption<int>(options, "learning-period", 0);
 	assert(0 <= learning_period);
 
+	// The model counts the nodes it creates and releases as it goes; each
+	// cycle logs the difference.
+	size_t nodes_created = ai.modelNodesCreated();
+	size_t nodes_released = ai.modelNodesReleased();
+
 	// Agent/environment interaction loop
 	for (int cycle = 1; !env.isFinished(); cycle++) {
 
@@ -69,8 +76,12 @@ void mainLoop(Agent &ai, Environment &env, options_t &options) {
 			break;
 		}
 		
-		// Save the current clock cycle (to compute how long this cycle took)
+		// Save the current clock cycle (to compute how long this cycle took),
+		// and the wall clock time, which unlike the processor time does not
+		// add up the time of every search thread
 		clock_t cycle_start = clock();
+		std::chrono::steady_clock::time_point wall_start =
+			std::chrono::steady_clock::now();
 
 		// Get a percept from the environment
 		percept_t observation = env.getObservation();
@@ -103,12 +114,23 @@ void mainLoop(Agent &ai, Environment &env, options_t &options) {
 		
 		// Calculate how long this cycle took
 		double time = double(clock() - cycle_start) / double(CLOCKS_PER_SEC);
+		double wall_time = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - wall_start).count();
 
 		// Log this turn
+		size_t created = ai.modelNodesCreated() - nodes_created;
+		size_t released = ai.modelNodesReleased() - nodes_released;
+		nodes_created += created;
+		nodes_released += released;
 		logger << cycle << ", " << observation << ", " << reward << ", "
 			<< action << ", " << explored << ", " << explore_rate << ", "
 			<< ai.totalReward() << ", " << ai.averageReward() << ", "
-			<< time << ", " << ai.modelSize() << std::endl;
+			<< time << ", " << ai.modelSize() << ", " << ai.modelPruned()
+			<< ", " << ai.modelBytes() << ", " << ai.compactTime() << ", "
+			<< ai.pathCostBefore() << ", " << ai.pathCostAfter() << ", "
+			<< ai.modelNodeBytes() << ", " << created << ", " << released
+			<< ", " << ai.modelDivergence() << ", " << ai.roundingDivergence()
+			<< ", " << wall_time << std::endl;
 
 		// Print to standard output when cycle == 2^n or on verbose option
 		if (verbose || (cycle & (cycle - 1)) == 0) {
@@ -133,6 +155,18 @@ void mainLoop(Agent &ai, Environment &env, options_t &options) {
 	std::cout << std::endl << std::endl << "SUMMARY" << std::endl;
 	std::cout << "agent age: " << ai.age() << std::endl;
 	std::cout << "average reward: " << ai.averageReward() << std::endl;
+	if (getOption<bool>(options, "huge-pages", false)) {
+		size_t requested, obtained;
+		hugePageUsage(requested, obtained);
+		std::cout << "huge pages: " << obtained << " of " << requested
+			<< " bytes" << std::endl;
+	}
+	if (ai.checksPrecision()) {
+		std::cout << "prediction divergence: mean " << ai.modelDivergenceMean()
+			<< ", max " << ai.modelDivergenceMax() << std::endl;
+		std::cout << "rounding divergence: mean " << ai.roundingDivergenceMean()
+			<< ", max " << ai.roundingDivergenceMax() << std::endl;
+	}
 }
 
 
@@ -212,8 +246,10 @@ int main(int argc, char *argv[]) {
 	// Set up logging, print header
 	logger.open(argv[2]);
 	logger << "cycle, observation, reward, action, explored, "
-	    << "explore_rate, total reward, average reward, time, model size"
-	    << std::endl;
+	    << "explore_rate, total reward, average reward, time, model size, "
+	    << "pruned nodes, model bytes, compact time, path cost before, "
+	    << "path cost after, node bytes, nodes created, nodes released, "
+	    << "prediction divergence, rounding divergence, wall time" << std::endl;
 
 
 	// Stores configuration options
@@ -273,19 +309,28 @@ int main(int argc, char *argv[]) {
 	options["max-observation"] = toString(env->maxObservation());
 	options["max-reward"] = toString(env->maxReward());
 
-	// Print options
+	// Set up the agent
+	Agent ai(options, *env);
+
+	// Print options, including those filled in by the agent
 	options_t::iterator it = options.begin();
 	for( ; it != options.end(); it++) {
 		std::cout << "OPTION: '" << it->first << "' = '" << it->second
 		          << "'" << std::endl;
 	}
 
-	// Set up the agent
-	Agent ai(options, *env);
-
 	// Run the main agent/environment interaction loop
 	mainLoop(ai, *env, options);
 
+	// Save the model so that later runs can start from it
+	if (options.count("save-model") > 0) {
+		if (!ai.saveModel(options["save-model"])) {
+			std::cerr << "ERROR: could not save model to '"
+			    << options["save-model"] << "'" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
 	logger.close();
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,128 @@
+#include <cstring>
+#include <fstream>
+#include "model_file.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+const char ModelFile::cMagic[8] = { 'C', 'T', 'W', 'M', 'O', 'D', 'E', 'L' };
+
+// The nodes start on a page boundary, so that they map onto whole pages.
+static const uint64_t page_size = 4096;
+
+// Round up to a multiple of a power of two.
+static uint64_t roundUp(const uint64_t n, const uint64_t multiple) {
+	return (n + multiple - 1) & ~(multiple - 1);
+}
+
+
+ModelFile::ModelFile(char *data, const size_t size, const bool mapped) :
+	m_data(data), m_size(size), m_mapped(mapped),
+	m_header(reinterpret_cast<const ModelHeader *>(data))
+{
+}
+
+
+ModelFile::~ModelFile(void) {
+#ifndef _WIN32
+	if (m_mapped) {
+		munmap(m_data, m_size);
+		return;
+	}
+#endif
+	delete[] reinterpret_cast<uint64_t *>(m_data);
+}
+
+
+// The history follows the header and the nodes follow the history.
+void ModelFile::layout(ModelHeader &header) {
+	std::memcpy(header.magic, cMagic, sizeof(header.magic));
+	header.version = cVersion;
+	header.byte_order = cByteOrderMark;
+	header.history_offset = roundUp(sizeof(ModelHeader), 64);
+	uint64_t history_bytes = (header.history_size + 63) / 64 * 8;
+	header.nodes_offset = roundUp(header.history_offset + history_bytes,
+		page_size);
+	header.file_size = header.nodes_offset +
+		header.node_count * header.node_bytes;
+}
+
+
+// Map or read the file, then check the header against the file.
+ModelFile *ModelFile::open(const std::string &path, std::string &error) {
+	ModelFile *model = NULL;
+
+#ifndef _WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0) close(fd);
+		error = "cannot open file";
+		return NULL;
+	}
+	size_t size = size_t(st.st_size);
+	if (size >= sizeof(ModelHeader)) {
+		void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			fd, 0);
+		if (data != MAP_FAILED)
+			model = new ModelFile(static_cast<char *>(data), size, true);
+	}
+	close(fd);
+#else
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in.is_open()) {
+		error = "cannot open file";
+		return NULL;
+	}
+	in.seekg(0, std::ios::end);
+	size_t size = size_t(in.tellg());
+	in.seekg(0, std::ios::beg);
+	if (size >= sizeof(ModelHeader)) {
+		char *data = reinterpret_cast<char *>(new uint64_t[(size + 7) / 8]);
+		in.read(data, size);
+		model = new ModelFile(data, size, false);
+	}
+#endif
+
+	if (model == NULL) {
+		error = "file too short";
+		return NULL;
+	}
+
+	// The layout must be exactly the one this version writes.
+	const ModelHeader &header = model->header();
+	ModelHeader expected = header;
+	layout(expected);
+	if (std::memcmp(header.magic, cMagic, sizeof(cMagic)) != 0) {
+		error = "not a saved model";
+	} else if (header.version == 0 || header.version > cVersion) {
+		error = "unsupported version";
+	} else if (header.byte_order != cByteOrderMark) {
+		error = "saved on a machine of different byte order";
+	} else if (header.node_count > cMaxNodeCount || header.node_bytes == 0 ||
+			header.node_bytes > page_size || header.history_size > size * 8) {
+		// Larger values could also overflow the layout computed above.
+		error = "invalid header";
+	} else if (header.history_offset != expected.history_offset ||
+			header.nodes_offset != expected.nodes_offset ||
+			header.file_size != expected.file_size || size < header.file_size) {
+		error = "file truncated or corrupt";
+	} else if (header.depth == 0 || header.depth > cMaxDepth ||
+			header.root == 0 || header.root >= header.node_count ||
+			header.node_format[sizeof(header.node_format) - 1] != '\0') {
+		error = "invalid header";
+	} else if (header.node_count > 2 && header.history_size != header.depth) {
+		// A tree grows beyond its root only once the history holds a whole
+		// context, and then the most recent depth symbols are saved.
+		error = "invalid header";
+	} else {
+		return model;
+	}
+	delete model;
+	return NULL;
+}
@@ -0,0 +1,139 @@
+#ifndef __MODEL_FILE_HPP__
+#define __MODEL_FILE_HPP__
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+/** The header at the start of a saved context tree (see ::ModelFile). Every
+ * field has a fixed width, and the header is a multiple of 8 bytes long. */
+struct ModelHeader {
+	/** ModelFile::cMagic, identifying the file. */
+	char magic[8];
+
+	/** The version of the format, ModelFile::cVersion. */
+	uint32_t version;
+
+	/** ModelFile::cByteOrderMark as written by the machine which saved the
+	 * file. A file is only readable on a machine of the same byte order. */
+	uint32_t byte_order;
+
+	/** The "ct-node-format" of the nodes, NUL-terminated. */
+	char node_format[16];
+
+	/** The size of a node in bytes. */
+	uint32_t node_bytes;
+
+	/** The depth of the context tree. */
+	uint32_t depth;
+
+	/** The number of node slots, including the unused slot ::null_index. */
+	uint64_t node_count;
+
+	/** The index of the root node. */
+	uint64_t root;
+
+	/** The number of history symbols saved. */
+	uint64_t history_size;
+
+	/** The offset of the history in the file. The history is stored in 64-bit
+	 * words, most recent symbol first: bit j of word k is the symbol appended
+	 * 64k + j symbols before the most recent one (see History::recent()). */
+	uint64_t history_offset;
+
+	/** The offset of the nodes in the file, a multiple of the page size. The
+	 * nodes are stored by index, exactly as they are laid out in memory, and
+	 * link to each other by index. */
+	uint64_t nodes_offset;
+
+	/** The size of the file in bytes. */
+	uint64_t file_size;
+};
+
+
+/** A ::ModelFile gives access to a context tree saved by
+ * ArenaContextTree::save(). The file is designed to be used in place: the
+ * nodes are stored as an array which a tree can adopt as its node arena (see
+ * Arena::attach()), so loading a model does not deserialize the nodes.
+ *
+ * Where possible (everywhere but Windows) the file is memory-mapped privately,
+ * so that the pages holding the nodes are only read from disk when they are
+ * used and a page is only copied when the tree changes a node in it. The file
+ * itself is never modified. Elsewhere the file is read into memory. */
+class ModelFile {
+public:
+
+	/** Open a saved model and check that it can be used on this machine.
+	 * \param path The file to open.
+	 * \param error Receives the reason if the file cannot be used.
+	 * \return The model, or NULL on failure. */
+	static ModelFile *open(const std::string &path, std::string &error);
+
+	/** Fill in the fields of a header which describe the layout of a file:
+	 * the magic number, version, byte order mark and offsets. The other fields
+	 * must already be set.
+	 * \param header The header to complete. */
+	static void layout(ModelHeader &header);
+
+	/** Unmap or free the file. Nodes adopted from it must no longer be in
+	 * use. */
+	~ModelFile(void);
+
+	/** \return The header of the file. */
+	const ModelHeader &header(void) const { return *m_header; }
+
+	/** \return The saved history words. See ModelHeader::history_offset. */
+	const uint64_t *history(void) const {
+		return reinterpret_cast<const uint64_t *>(m_data +
+			m_header->history_offset);
+	}
+
+	/** \return The saved nodes, which may be modified without changing the
+	 * file. */
+	void *nodes(void) { return m_data + m_header->nodes_offset; }
+
+	/** The value of ModelHeader::magic. */
+	static const char cMagic[8];
+
+	/** The current version of the format. Version 2 added chain nodes (see
+	 * ::chain_index); files of version 1 are still read. */
+	static const uint32_t cVersion = 2;
+
+	/** Written to ModelHeader::byte_order to detect the byte order. */
+	static const uint32_t cByteOrderMark = 0x01020304u;
+
+	/** The largest ModelHeader::node_count. Nodes link to each other by 32-bit
+	 * index, and the two largest indices are reserved (see ::chain_index). */
+	static const uint64_t cMaxNodeCount = 0xFFFFFFFEu;
+
+	/** The largest ModelHeader::depth, so that the depth and the number of
+	 * levels below the root are both an int. */
+	static const uint32_t cMaxDepth = 0x7FFFFFFEu;
+
+private:
+
+	/** Take over a file's contents.
+	 * \param data The contents.
+	 * \param size The size of the file.
+	 * \param mapped True if the contents are mapped, false if they are held
+	 * in memory allocated with new[]. */
+	ModelFile(char *data, const size_t size, const bool mapped);
+
+	/** The contents of the file. */
+	char *m_data;
+
+	/** The size of the file. */
+	size_t m_size;
+
+	/** True if ModelFile::m_data is a memory mapping. */
+	bool m_mapped;
+
+	/** The header, at the start of ModelFile::m_data. */
+	const ModelHeader *m_header;
+
+	// Model files own their contents and cannot be copied.
+	ModelFile(const ModelFile &);
+	ModelFile &operator=(const ModelFile &);
+};
+
+#endif // __MODEL_FILE_HPP__
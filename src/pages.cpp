@@ -0,0 +1,157 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <stdint.h>
+#include "pages.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+
+// How the huge pages asked for by a region of memory were provided.
+enum page_backing_t { normal_backing, explicit_backing, transparent_backing };
+
+// The regions allocated with huge pages requested, by address, with their
+// sizes and backing. Arenas on several threads may allocate at once.
+struct PageRegion {
+	size_t bytes;
+	page_backing_t backing;
+};
+static std::map<uintptr_t, PageRegion> huge_regions;
+static std::mutex huge_regions_mutex;
+
+// Round up to a multiple of a power of two.
+static size_t roundUp(const size_t n, const size_t multiple) {
+	return (n + multiple - 1) & ~(multiple - 1);
+}
+
+static void recordRegion(void *pages, const size_t bytes,
+		const page_backing_t backing) {
+	std::lock_guard<std::mutex> lock(huge_regions_mutex);
+	PageRegion &region = huge_regions[reinterpret_cast<uintptr_t>(pages)];
+	region.bytes = bytes;
+	region.backing = backing;
+}
+
+
+// Try explicit huge pages, then aligned memory marked for transparent huge
+// pages, then normal pages.
+void *allocatePages(const size_t bytes, const bool huge) {
+	void *pages = NULL;
+#ifndef _WIN32
+	size_t length = huge ? roundUp(bytes, huge_page_bytes) : bytes;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+	if (huge) {
+		pages = mmap(NULL, length, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+			-1, 0);
+		if (pages != MAP_FAILED) {
+			recordRegion(pages, length, explicit_backing);
+			return pages;
+		}
+	}
+#endif
+	if (huge) {
+		// Map an extra huge page and trim the ends, so that the region starts
+		// on a huge page boundary.
+		char *raw = static_cast<char *>(mmap(NULL, length + huge_page_bytes,
+			PROT_READ | PROT_WRITE, flags, -1, 0));
+		if (raw != MAP_FAILED) {
+			char *aligned = reinterpret_cast<char *>(roundUp(
+				reinterpret_cast<uintptr_t>(raw), huge_page_bytes));
+			if (aligned > raw) munmap(raw, aligned - raw);
+			munmap(aligned + length, raw + huge_page_bytes - aligned);
+			page_backing_t backing = normal_backing;
+#ifdef MADV_HUGEPAGE
+			if (madvise(aligned, length, MADV_HUGEPAGE) == 0)
+				backing = transparent_backing;
+#endif
+			recordRegion(aligned, length, backing);
+			return aligned;
+		}
+	} else {
+		pages = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (pages != MAP_FAILED) return pages;
+	}
+	pages = NULL;
+#else
+	pages = new (std::nothrow) uint64_t[(bytes + 7) / 8]();
+	if (pages && huge) recordRegion(pages, bytes, normal_backing);
+#endif
+	if (pages == NULL) {
+		std::cerr << "ERROR: out of memory allocating " << bytes << " bytes"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	return pages;
+}
+
+
+void releasePages(void *pages, const size_t bytes, const bool huge) {
+	if (huge) {
+		std::lock_guard<std::mutex> lock(huge_regions_mutex);
+		huge_regions.erase(reinterpret_cast<uintptr_t>(pages));
+	}
+#ifndef _WIN32
+	munmap(pages, huge ? roundUp(bytes, huge_page_bytes) : bytes);
+#else
+	delete[] static_cast<uint64_t *>(pages);
+#endif
+}
+
+
+// Explicit huge pages are reserved when they are mapped. Transparent ones are
+// found in the AnonHugePages lines of the mappings which overlap a region.
+void hugePageUsage(size_t &requested, size_t &obtained) {
+	std::lock_guard<std::mutex> lock(huge_regions_mutex);
+	requested = 0;
+	obtained = 0;
+	bool transparent = false;
+	std::map<uintptr_t, PageRegion>::const_iterator it;
+	for (it = huge_regions.begin(); it != huge_regions.end(); it++) {
+		requested += it->second.bytes;
+		if (it->second.backing == explicit_backing)
+			obtained += it->second.bytes;
+		if (it->second.backing == transparent_backing)
+			transparent = true;
+	}
+	if (!transparent) return;
+
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	bool overlaps = false;
+	while (std::getline(smaps, line)) {
+		std::istringstream fields(line);
+		std::string name;
+		fields >> name;
+		if (name == "AnonHugePages:") {
+			size_t kb = 0;
+			fields >> kb;
+			if (overlaps) obtained += kb * 1024;
+			continue;
+		}
+
+		// A mapping's first line starts with its address range.
+		size_t dash = name.find('-');
+		if (dash == std::string::npos || name[name.size() - 1] == ':')
+			continue;
+		uintptr_t start = uintptr_t(strtoull(name.c_str(), NULL, 16));
+		uintptr_t end = uintptr_t(strtoull(name.c_str() + dash + 1, NULL, 16));
+		overlaps = false;
+		it = huge_regions.lower_bound(start);
+		if (it != huge_regions.begin()) {
+			std::map<uintptr_t, PageRegion>::const_iterator before = it;
+			before--;
+			if (before->first + before->second.bytes > start) it = before;
+		}
+		for (; it != huge_regions.end() && it->first < end; it++) {
+			if (it->second.backing == transparent_backing) overlaps = true;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef __PAGES_HPP__
+#define __PAGES_HPP__
+
+#include <cstddef>
+
+/** The size of the huge pages requested by allocatePages(). */
+static const size_t huge_page_bytes = size_t(2) << 20;
+
+/** Allocate zero-filled memory directly from the operating system, on whole
+ * pages. Where possible (everywhere but Windows) the memory is mapped.
+ *
+ * Huge pages hold 512 times as much memory per TLB entry as normal pages,
+ * which matters for large structures read at random such as the context tree.
+ * When they are requested, explicit huge pages (MAP_HUGETLB) are tried first,
+ * which the system only has if they have been reserved. Otherwise the memory
+ * is aligned to ::huge_page_bytes and marked for transparent huge pages
+ * (madvise(MADV_HUGEPAGE)), which the kernel provides if it can and replaces
+ * with normal pages if not. Whether they were obtained is reported by
+ * hugePageUsage().
+ * \param bytes The number of bytes to allocate.
+ * \param huge True to ask for huge pages.
+ * \return The memory. The program exits if there is none. */
+void *allocatePages(const size_t bytes, const bool huge);
+
+/** Free memory allocated by allocatePages().
+ * \param pages The memory.
+ * \param bytes The number of bytes passed to allocatePages().
+ * \param huge The request passed to allocatePages(). */
+void releasePages(void *pages, const size_t bytes, const bool huge);
+
+/** Measure the memory allocated by allocatePages() with huge pages requested
+ * and not yet released.
+ * \param requested Receives the number of bytes allocated.
+ * \param obtained Receives the number of those bytes which are backed by
+ * huge pages. Transparent huge pages are counted as reported by the kernel
+ * (/proc/self/smaps), so memory which has never been touched is not yet
+ * backed by either kind of page and is not counted. */
+void hugePageUsage(size_t &requested, size_t &obtained);
+
+#endif // __PAGES_HPP__
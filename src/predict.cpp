@@ -1,6 +1,17 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "model_file.hpp"
+#include "pages.hpp"
 #include "predict.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 
 
@@ -8,130 +19,785 @@
  * is made a constant for efficiency reasons. */
 static const double log_half = std::log(0.5);
 
+
+// Table of ln(1 + exp(-x)) sampled every 1/log_add_scale for x in
+// [0, log_add_limit], built by CTNode::setLogAddTable(). Empty when the exact
+// computation is in use.
+static std::vector<double> log_add_table;
+static const double log_add_scale = 256.0;
+static const double log_add_limit = 40.0;
+
+// ln(1 + exp(-x)) for x >= 0, interpolated linearly between table entries.
+// Beyond log_add_limit the result is below 5e-18 and is taken to be zero.
+static inline double logAddTable(const double x) {
+	if (!(x < log_add_limit)) return 0.0;
+	double t = x * log_add_scale;
+	int i = int(t);
+	return log_add_table[i] + (t - i) * (log_add_table[i + 1] - log_add_table[i]);
+}
+
+// The log of an even mixture of two probabilities, ln(p/2 + q/2), given ln p
+// and ln q. Use the formulation which has the least chance of overflow (see
+// CTNode::updateLogProbability() for details).
+static inline double logMixture(const double log_p, const double log_q) {
+	double a = std::max(log_p, log_q);
+	double b = std::min(log_p, log_q);
+	if (!log_add_table.empty()) return log_half + a + logAddTable(a - b);
+	return log_half + a + std::log(1.0 + std::exp(b - a));
+}
+
+
+// ln G(x) for x > 0. The POSIX std::lgamma stores the sign of G(x) in a
+// global, which races when several search threads use it; lgamma_r does not.
+static inline double logGamma(const double x) {
+#ifdef _WIN32
+	return std::lgamma(x);
+#else
+	int sign;
+	return lgamma_r(x, &sign);
+#endif
+}
+
+
+// Tables of ln(k + 1/2), ln(k + 1), ln G(k + 1/2) and ln G(k + 1) for small
+// counts k, built by CTNode::setLogTableSize().
+static std::vector<double> log_plus_half_table;
+static std::vector<double> log_plus_one_table;
+static std::vector<double> log_gamma_half_table;
+static std::vector<double> log_gamma_one_table;
+
+// ln G(k + 1/2), looked up if k is small enough.
+static inline double logGammaPlusHalf(const int k) {
+	return k < int(log_gamma_half_table.size()) ?
+		log_gamma_half_table[k] : logGamma(k + 0.5);
+}
+
+// ln G(k + 1), looked up if k is small enough.
+static inline double logGammaPlusOne(const int k) {
+	return k < int(log_gamma_one_table.size()) ?
+		log_gamma_one_table[k] : logGamma(k + 1.0);
+}
+
+// ln Pr_kt(a, b) = ln G(a + 1/2) + ln G(b + 1/2) - 2 ln G(1/2) - ln G(a + b + 1),
+// which follows from unrolling the KT update relations.
+static inline double logKTEstimate(const int a, const int b) {
+	static const double log_gamma_half = logGamma(0.5);
+	return logGammaPlusHalf(a) + logGammaPlusHalf(b)
+		- 2.0 * log_gamma_half - logGammaPlusOne(a + b);
+}
+
+// ln(k + 1/2), looked up if k is small enough.
+static inline double logPlusHalf(const int k) {
+	return k < int(log_plus_half_table.size()) ?
+		log_plus_half_table[k] : std::log(k + 0.5);
+}
+
+// ln(k + 1), looked up if k is small enough.
+static inline double logPlusOne(const int k) {
+	return k < int(log_plus_one_table.size()) ?
+		log_plus_one_table[k] : std::log(k + 1.0);
+}
+
+
+// The context below a chain node: bit k is the symbol which selects the child
+// at level + 1 + k, for the depth - level levels below the node. Unused bits
+// are zero.
+static void chainContext(const History &history, const int level,
+		const int depth, uint64_t &low, uint32_t &high) {
+	const int levels = depth - level;
+	assert(levels > 0 && levels <= chain_levels);
+	low = history.context(level);
+	high = levels > 64 ? uint32_t(history.context(level + 64)) : 0;
+	if (levels < 64) {
+		low &= (uint64_t(1) << levels) - 1;
+	} else if (levels > 64 && levels < chain_levels) {
+		high &= (uint32_t(1) << (levels - 64)) - 1;
+	}
+}
+
+
+// The position of the lowest set bit of a nonzero word.
+static inline int lowestBit(const uint64_t word) {
+	assert(word != 0);
+#ifdef __GNUC__
+	return __builtin_ctzll(word);
+#else
+	int bit = 0;
+	while (((word >> bit) & 1) == 0) bit++;
+	return bit;
+#endif
+}
+
+
+// The number of leading levels on which a chain's context and the current
+// one agree.
+static int chainAgreement(const uint64_t low, const uint32_t high,
+		const History &history, const int level, const int depth) {
+	uint64_t context_low;
+	uint32_t context_high;
+	chainContext(history, level, depth, context_low, context_high);
+	if (low != context_low) return lowestBit(low ^ context_low);
+	if (high != context_high) return 64 + lowestBit(high ^ context_high);
+	return depth - level;
+}
+
+
+
+
 CTNode::CTNode(void) :
 	m_log_kt(0.0), m_log_probability(0.0)
 {
 	m_count[0] = 0;
 	m_count[1] = 0;
-	m_child[0] = NULL;
-	m_child[1] = NULL;
+	m_child[0] = null_index;
+	m_child[1] = null_index;
 }
 
 
-// Delete child nodes.
-CTNode::~CTNode(void) {
-	if (m_child[0])
-		delete m_child[0];
-	if (m_child[1])
-		delete m_child[1];
+// The number of descendants plus one.
+int CTNode::size(const Arena<CTNode> &nodes) const {
+	if (!linksChildren()) return 1;
+	return 1 + (child(false) ? nodes[child(false)].size(nodes) : 0) +
+		(child(true) ? nodes[child(true)].size(nodes) : 0);
 }
 
 
-// The number of descendants plus one.
-int CTNode::size(void) const {
-	return 1 + (child(false) ? child(false)->size() : 0) +
-		(child(true) ? child(true)->size() : 0);
+// Build the logarithm tables used by logKTMultiplier() and logKTEstimate().
+void CTNode::setLogTableSize(const int size) {
+	assert(size >= 0);
+	log_plus_half_table.resize(size);
+	log_plus_one_table.resize(size);
+	log_gamma_half_table.resize(size);
+	log_gamma_one_table.resize(size);
+	for (int k = 0; k < size; k++) {
+		log_plus_half_table[k] = std::log(k + 0.5);
+		log_plus_one_table[k] = std::log(k + 1.0);
+		log_gamma_half_table[k] = logGamma(k + 0.5);
+		log_gamma_one_table[k] = logGamma(k + 1.0);
+	}
+}
+
+
+// Build or discard the table used by logMixture().
+double CTNode::setLogAddTable(const bool enable) {
+	log_add_table.clear();
+	if (!enable) return 0.0;
+
+	int entries = int(log_add_limit * log_add_scale) + 1;
+	log_add_table.resize(entries);
+	for (int i = 0; i < entries; i++) {
+		log_add_table[i] = std::log1p(std::exp(-i / log_add_scale));
+	}
+
+	// The interpolation error is largest between table entries; measure it
+	// at each midpoint.
+	double max_error = 0.0;
+	for (int i = 0; i + 1 < entries; i++) {
+		double x = (i + 0.5) / log_add_scale;
+		double error = std::fabs(logAddTable(x) - std::log1p(std::exp(-x)));
+		max_error = std::max(max_error, error);
+	}
+	return max_error;
 }
 
 
 // Added to the previous logKT estimate upon observing a new symbol.
 weight_t CTNode::logKTMultiplier(const symbol_t symbol) const {
-	double numerator = double(m_count[symbol]) + 0.5;
-	double denominator = double(visits() + 1);
-	return std::log(numerator / denominator);
+	return logPlusHalf(m_count[symbol]) - logPlusOne(visits());
+}
+
+
+// The KT estimate after one more update with the given symbol.
+weight_t CTNode::logKTAfter(const symbol_t symbol) const {
+	return m_log_kt + logKTMultiplier(symbol);
 }
 
 
 // Recalculate the log weighted probability for this node. Preconditions are:
 //  * m_log_prob_est is correct.
 //  * logProbWeighted() is correct for each child node.
-void CTNode::updateLogProbability(void) {
+void CTNode::updateLogProbability(const Arena<CTNode> &nodes) {
 
 	// Calculate the log weighted probability. If the current node is a leaf
 	// node, this is just the KT estimate. Otherwise it is an even mixture of
 	// the KT estimate and the product of the weighted probabilities of the
-	// children.
-	if (isLeafNode()) {
+	// children. A chain node has no room to cache it.
+	if (isChain()) {
+		return;
+	} else if (isLeafNode()) {
 		m_log_probability = m_log_kt;
 	} else {
 		// The sum of the log weighted probabilities of the child nodes
 		double log_child_prob = 0.0;
-		log_child_prob += child(false) ? child(false)->logProbability() : 0.0;
-		log_child_prob += child(true) ? child(true)->logProbability() : 0.0;
+		log_child_prob += child(false) ? nodes[child(false)].logProbability() : 0.0;
+		log_child_prob += child(true) ? nodes[child(true)].logProbability() : 0.0;
 
-		// Calculate the log weighted probability. Use the formulation which
-		// has the least chance of overflow (see function doc for details).
-		double a = std::max(m_log_kt, log_child_prob);
-		double b = std::min(m_log_kt, log_child_prob);
-		m_log_probability = log_half + a + std::log(1.0 + std::exp(b - a));
+		m_log_probability = logMixture(m_log_kt, log_child_prob);
 	}
 }
 
 
 // Update probability estimates upon observing a new symbol.
-void CTNode::update(const symbol_t symbol) {
+void CTNode::update(const symbol_t symbol, const Arena<CTNode> &nodes) {
 	m_log_kt += logKTMultiplier(symbol);       // Update KT estimate
-	updateLogProbability();                    // Update weighted probability
+	updateLogProbability(nodes);               // Update weighted probability
 	m_count[symbol]++;                         // Update symbol counts
 }
 
 
+// Update with a KT estimate and weighted probability computed in advance.
+void CTNode::update(const symbol_t symbol, const weight_t log_kt,
+		const weight_t log_probability) {
+	m_log_kt = log_kt;
+	if (!isChain()) m_log_probability = log_probability;
+	m_count[symbol]++;
+}
+
+
 // Revert probability estimates to their most recent state.
-void CTNode::revert(const symbol_t symbol) {
+// Children are reverted before their parent, so a child which is no longer
+// visited has already released its own children and can go straight back to
+// the arena.
+int CTNode::revert(const symbol_t symbol, Arena<CTNode> &nodes) {
 	m_count[symbol]--;                   // Revert symbol count
-	if(m_child[symbol] && m_child[symbol]->visits() == 0) { // Delete unnecessary child node
-		delete m_child[symbol];
-		m_child[symbol] = NULL;
+	int released = 0;
+	for (int c = 0; c < 2 && linksChildren(); c++) { // Release unvisited children
+		if (m_child[c] && nodes[m_child[c]].visits() == 0) {
+			nodes.release(m_child[c]);
+			m_child[c] = null_index;
+			released++;
+		}
 	}
 
 	m_log_kt -= logKTMultiplier(symbol); // Revert KT estimate
-	updateLogProbability();              // Revert weighted probability
+	updateLogProbability(nodes);         // Revert weighted probability
+	return released;
+}
+
+
+void CTNode::makeChain(const History &history, const int level,
+		const int depth) {
+	uint64_t low;
+	uint32_t high;
+	chainContext(history, level, depth, low, high);
+	m_chain = low;
+	m_child[0] = chain_index;
+	m_child[1] = high;
+}
+
+
+int CTNode::chainAgreement(const History &history, const int level,
+		const int depth) const {
+	return ::chainAgreement(m_chain, m_child[1], history, level, depth);
+}
+
+
+// The child takes the context shifted by one level. At the maximum depth it is
+// an ordinary leaf instead.
+void CTNode::expandChain(CTNode &child, const arena_index_t link,
+		const int level, const int depth) {
+	const symbol_t symbol = (m_chain & 1) != 0;
+	child = *this;
+	if (level + 1 < depth) {
+		child.m_chain = (m_chain >> 1) | (uint64_t(m_child[1] & 1) << 63);
+		child.m_child[1] = m_child[1] >> 1;
+	} else {
+		child.m_child[0] = null_index;
+		child.m_child[1] = null_index;
+		child.m_log_probability = m_log_kt;
+	}
+	m_child[symbol] = link;
+	m_child[!symbol] = null_index;
+	m_log_probability = m_log_kt;
+}
+
+
+bool CTNode::mergeChain(const CTNode &child, const int level,
+		const int depth) {
+	const symbol_t symbol = m_child[0] == null_index;
+	if (m_child[!symbol] != null_index || m_child[symbol] == null_index ||
+			m_count[0] != child.m_count[0] || m_count[1] != child.m_count[1])
+		return false;
+	if (level + 1 < depth) {
+		if (!child.isChain()) return false;
+		m_chain = (child.m_chain << 1) | uint64_t(symbol);
+		m_child[1] = (child.m_child[1] << 1) | uint32_t(child.m_chain >> 63);
+	} else {
+		m_chain = uint64_t(symbol);
+		m_child[1] = 0;
+	}
+	m_child[0] = chain_index;
+	return true;
+}
+
+
+
+
+template <class Count, class Weight>
+CountingCTNode<Count, Weight>::CountingCTNode(void) {
+	m_log_probability = 0.0;
+	m_count[0] = 0;
+	m_count[1] = 0;
+	m_child[0] = null_index;
+	m_child[1] = null_index;
+}
+
+
+// The KT estimate is a function of the counts alone.
+template <class Count, class Weight>
+weight_t CountingCTNode<Count, Weight>::logKT(void) const {
+	return logKTEstimate(m_count[0], m_count[1]);
+}
+
+
+// The number of descendants plus one.
+template <class Count, class Weight>
+int CountingCTNode<Count, Weight>::size(
+		const Arena<CountingCTNode> &nodes) const {
+	if (!linksChildren()) return 1;
+	return 1 + (child(false) ? nodes[child(false)].size(nodes) : 0) +
+		(child(true) ? nodes[child(true)].size(nodes) : 0);
+}
+
+
+// Recalculate the log weighted probability for this node from its counts and
+// the weighted probabilities of its children.
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::updateLogProbability(
+		const Arena<CountingCTNode> &nodes) {
+	if (isChain()) {
+		return;
+	} else if (isLeafNode()) {
+		m_log_probability = logKT();
+	} else {
+		double log_child_prob = 0.0;
+		log_child_prob += child(false) ? nodes[child(false)].logProbability() : 0.0;
+		log_child_prob += child(true) ? nodes[child(true)].logProbability() : 0.0;
+		m_log_probability = logMixture(logKT(), log_child_prob);
+	}
+}
+
+
+// The KT estimate after one more update with the given symbol, mirroring the
+// halving done by update().
+template <class Count, class Weight>
+weight_t CountingCTNode<Count, Weight>::logKTAfter(
+		const symbol_t symbol) const {
+	CountingCTNode after = *this;
+	if (after.m_count[symbol] == cMaxCount) after.halveCounts();
+	after.m_count[symbol]++;
+	return after.logKT();
+}
+
+
+// Update probability estimates upon observing a new symbol. Counts which are
+// about to overflow are halved.
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::update(const symbol_t symbol,
+		const Arena<CountingCTNode> &nodes) {
+	if (m_count[symbol] == cMaxCount) halveCounts();
+	m_count[symbol]++;
+	updateLogProbability(nodes);
+}
+
+
+// Update with a weighted probability computed in advance.
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::update(const symbol_t symbol,
+		const weight_t /* log_kt */, const weight_t log_probability) {
+	if (m_count[symbol] == cMaxCount) halveCounts();
+	m_count[symbol]++;
+	if (!isChain()) m_log_probability = log_probability;
+}
+
+
+// Revert probability estimates to their most recent state.
+template <class Count, class Weight>
+int CountingCTNode<Count, Weight>::revert(const symbol_t symbol,
+		Arena<CountingCTNode> &nodes) {
+	if (m_count[symbol] > 0)
+		m_count[symbol]--;
+	int released = 0;
+	for (int c = 0; c < 2 && linksChildren(); c++) {
+		if (m_child[c] && nodes[m_child[c]].visits() == 0) {
+			nodes.release(m_child[c]);
+			m_child[c] = null_index;
+			released++;
+		}
+	}
+	updateLogProbability(nodes);
+	return released;
+}
+
+
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::makeChain(const History &history,
+		const int level, const int depth) {
+	uint64_t low;
+	uint32_t high;
+	::chainContext(history, level, depth, low, high);
+	m_child[0] = chain_index;
+	setChainContext(low, high);
+}
+
+
+template <class Count, class Weight>
+int CountingCTNode<Count, Weight>::chainAgreement(const History &history,
+		const int level, const int depth) const {
+	uint64_t low;
+	uint32_t high;
+	chainContext(low, high);
+	return ::chainAgreement(low, high, history, level, depth);
+}
+
+
+// See CTNode::expandChain().
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::expandChain(CountingCTNode &child,
+		const arena_index_t link, const int level, const int depth) {
+	uint64_t low;
+	uint32_t high;
+	chainContext(low, high);
+	const symbol_t symbol = (low & 1) != 0;
+	child = *this;
+	if (level + 1 < depth) {
+		child.setChainContext((low >> 1) | (uint64_t(high & 1) << 63),
+			high >> 1);
+	} else {
+		child.m_child[0] = null_index;
+		child.m_child[1] = null_index;
+		child.m_log_probability = logKT();
+	}
+	m_child[symbol] = link;
+	m_child[!symbol] = null_index;
+	m_log_probability = logKT();
+}
+
+
+template <class Count, class Weight>
+bool CountingCTNode<Count, Weight>::mergeChain(const CountingCTNode &child,
+		const int level, const int depth) {
+	const symbol_t symbol = m_child[0] == null_index;
+	if (m_child[!symbol] != null_index || m_child[symbol] == null_index ||
+			m_count[0] != child.m_count[0] || m_count[1] != child.m_count[1])
+		return false;
+	uint64_t low = 0;
+	uint32_t high = 0;
+	if (level + 1 < depth) {
+		if (!child.isChain()) return false;
+		child.chainContext(low, high);
+		high = (high << 1) | uint32_t(low >> 63);
+		low <<= 1;
+	}
+	m_child[0] = chain_index;
+	setChainContext(low | uint64_t(symbol), high);
+	return true;
+}
+
+
+// n - n/2 rounds up without overflowing.
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::halveCounts(void) {
+	m_count[0] -= m_count[0] / 2;
+	m_count[1] -= m_count[1] / 2;
+}
+
+
+// A chain_t of 64 bits holds the first 64 symbols and the second child link
+// the rest. One of 32 bits holds the first 32 and the link the next 32.
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::chainContext(uint64_t &low,
+		uint32_t &high) const {
+	if (sizeof(chain_t) == 8) {
+		low = uint64_t(m_chain);
+		high = m_child[1];
+	} else {
+		low = uint64_t(m_chain) | (uint64_t(m_child[1]) << 32);
+		high = 0;
+	}
+}
+
+
+template <class Count, class Weight>
+void CountingCTNode<Count, Weight>::setChainContext(const uint64_t low,
+		const uint32_t high) {
+	m_chain = chain_t(low);
+	if (sizeof(chain_t) == 8) {
+		m_child[1] = high;
+	} else {
+		assert(high == 0);
+		m_child[1] = uint32_t(low >> 32);
+	}
 }
 
 
+template class CountingCTNode<uint16_t, double>;
+template class CountingCTNode<uint32_t, double>;
+template class CountingCTNode<uint16_t, float>;
+template class CountingCTNode<uint16_t, FixedLogWeight>;
+
 
 
-ContextTree::ContextTree(const int depth) :
-	m_root(new CTNode()), m_depth(depth)
+
+ContextTree::ContextTree(const int depth, const size_t revert_bits) :
+	m_history(depth + revert_bits), m_depth(depth), m_context_span(depth),
+	m_counts(depth)
 {
 	assert(depth > 0);
-	m_context = new CTNode*[m_depth + 1];
-	return;
 }
 
 
-// Delete tree and history.
-ContextTree::~ContextTree(void) {
-	m_history.clear();
-	delete[] m_context;
-	if (m_root)
-		delete m_root;
+// The history keeps the oldest symbol chosen on top of those to be reverted.
+void ContextTree::selectContext(const std::vector<size_t> &ages) {
+	assert(ages.size() == size_t(m_depth) && m_history.size() == 0);
+	m_history.selectContext(ages);
+	m_context_span = *std::max_element(ages.begin(), ages.end()) + 1;
 }
 
 
-// Clear tree and history.
-void ContextTree::clear(void) {
-	m_history.clear();
-	if (m_root)
-		delete m_root;
-	m_root = new CTNode();
+// The name of each node format in "ct-node-format" and saved models.
+static const char *formatName(const CTNode *) { return "standard"; }
+static const char *formatName(const CompactCTNode *) { return "compact"; }
+static const char *formatName(const CountOnlyCTNode *) {
+	return "count-only";
+}
+static const char *formatName(const CompactFloatCTNode *) {
+	return "compact-float";
+}
+static const char *formatName(const CompactFixedCTNode *) {
+	return "compact-fixed";
 }
 
 
-// Update the tree with a single new symbol.
-void ContextTree::update(const symbol_t symbol) {
+// The number of entries in a hashed model with no node budget.
+static const size_t hashed_default_entries = size_t(1) << 20;
 
-	// Traverse the tree from leaf to root according to the context. Update the
-	// probabilities and symbol counts for each node.
-	if (m_history.size() >= m_depth) {
-		updateContext();
-		for (int i = m_depth; i >= 0; i--) {
-			m_context[i]->update(symbol);
+
+// Create a tree of the given backend and node format, empty or from a saved
+// model.
+static ContextTree *createTree(const std::string &backend,
+		const std::string &format, const int depth, const size_t revert_bits,
+		const bool journal, const size_t max_nodes, const bool lazy,
+		const bool huge_pages, ModelFile *model = NULL) {
+	if (backend == "hashed") {
+		return new HashedContextTree(depth, revert_bits, journal, max_nodes);
+	}
+	if (format == "compact") {
+		return new ArenaContextTree<CompactCTNode>(depth, revert_bits,
+			journal, max_nodes, lazy, huge_pages, model);
+	}
+	if (format == "count-only") {
+		return new ArenaContextTree<CountOnlyCTNode>(depth, revert_bits,
+			journal, max_nodes, lazy, huge_pages, model);
+	}
+	if (format == "compact-float") {
+		return new ArenaContextTree<CompactFloatCTNode>(depth, revert_bits,
+			journal, max_nodes, lazy, huge_pages, model);
+	}
+	if (format == "compact-fixed") {
+		return new ArenaContextTree<CompactFixedCTNode>(depth, revert_bits,
+			journal, max_nodes, lazy, huge_pages, model);
+	}
+	return new ArenaContextTree<CTNode>(depth, revert_bits, journal,
+		max_nodes, lazy, huge_pages, model);
+}
+
+
+// Parse a list of ages and ranges of ages such as "0-7,24".
+static bool parseContext(const std::string &list, std::vector<size_t> &ages) {
+	std::istringstream in(list);
+	ages.clear();
+	while (in.good()) {
+		size_t first, last;
+		if (!(in >> first)) return false;
+		last = first;
+		if (in.peek() == '-') {
+			in.ignore(1);
+			if (!(in >> last) || last < first) return false;
+		}
+		for (size_t age = first; age <= last; age++) {
+			ages.push_back(age);
+		}
+		if (in.peek() == ',') {
+			in.ignore(1);
+		} else if (in.peek() != std::char_traits<char>::eof()) {
+			return false;
 		}
 	}
+	return !ages.empty();
+}
 
-	// Add symbol to history
-	updateHistory(symbol);
+
+// Create a context tree of the type given by the configuration options.
+ContextTree *ContextTree::create(options_t &options, const size_t revert_bits,
+		const int percept_bits) {
+	int depth = getRequiredOption<int>(options, "ct-depth");
+	std::string format = getOption<std::string>(options, "ct-node-format",
+		"standard");
+	std::string backend = getOption<std::string>(options, "ct-backend",
+		"arena");
+	std::string model = getOption<std::string>(options, "ct-model", "single");
+	std::string log_add = getOption<std::string>(options, "ct-log-add", "exact");
+	std::string revert = getOption<std::string>(options, "ct-revert",
+		"journal");
+	std::string expand = getOption<std::string>(options, "ct-expand",
+		"eager");
+	bool huge_pages = getOption<bool>(options, "huge-pages", false);
+
+	// A saved model determines the shape of the tree.
+	ModelFile *saved = NULL;
+	if (options.count("load-model") > 0) {
+		std::string error;
+		saved = ModelFile::open(options["load-model"], error);
+		if (saved == NULL) {
+			std::cerr << "ERROR: cannot load model '" << options["load-model"]
+				<< "': " << error << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		depth = int(saved->header().depth);
+		format = saved->header().node_format;
+		options["ct-depth"] = toString(depth);
+		options["ct-node-format"] = format;
+	}
+
+	// A chosen context determines the depth.
+	std::vector<size_t> context;
+	if (options.count("ct-context") > 0) {
+		if (!parseContext(options["ct-context"], context)) {
+			std::cerr << "ERROR: invalid ct-context '" << options["ct-context"]
+				<< "'" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (saved || options.count("save-model") > 0) {
+			std::cerr << "ERROR: load-model and save-model cannot be used "
+				<< "with ct-context" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		depth = int(context.size());
+		options["ct-depth"] = toString(depth);
+	}
+
+	if ((model != "single" || backend != "arena") &&
+			(saved || options.count("save-model") > 0)) {
+		std::cerr << "ERROR: load-model and save-model require ct-model = "
+			<< "single and ct-backend = arena" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (backend != "arena" && backend != "hashed") {
+		std::cerr << "ERROR: unknown ct-backend '" << backend << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	if (backend == "hashed" && depth > 0xFF) {
+		std::cerr << "ERROR: ct-backend = hashed supports a ct-depth of at "
+			<< "most 255" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	CTNode::setLogTableSize(getOption<int>(options, "ct-log-table-size", 4096));
+
+	if (log_add != "exact" && log_add != "table") {
+		std::cerr << "ERROR: unknown ct-log-add '" << log_add << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	double log_add_error = CTNode::setLogAddTable(log_add == "table");
+
+	if (revert != "journal" && revert != "recompute") {
+		std::cerr << "ERROR: unknown ct-revert '" << revert << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	bool journal = revert == "journal";
+
+	if (expand != "eager" && expand != "lazy") {
+		std::cerr << "ERROR: unknown ct-expand '" << expand << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	bool lazy = expand == "lazy";
+
+	size_t node_bytes;
+	if (format == "standard") {
+		node_bytes = sizeof(CTNode);
+	} else if (format == "compact") {
+		node_bytes = sizeof(CompactCTNode);
+	} else if (format == "count-only") {
+		node_bytes = sizeof(CountOnlyCTNode);
+	} else if (format == "compact-float") {
+		node_bytes = sizeof(CompactFloatCTNode);
+	} else if (format == "compact-fixed") {
+		node_bytes = sizeof(CompactFixedCTNode);
+	} else {
+		std::cerr << "ERROR: unknown ct-node-format '" << format << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+	if (backend == "hashed") {
+		node_bytes = HashedContextTree::entryBytes();
+	}
+	if (saved && saved->header().node_bytes != node_bytes) {
+		std::cerr << "ERROR: cannot load model '" << options["load-model"]
+			<< "': saved with a different node layout" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// The node budget is the tighter of the two limits, if any.
+	size_t max_nodes = getOption<size_t>(options, "ct-max-nodes", 0);
+	size_t max_bytes = getOption<size_t>(options, "ct-max-bytes", 0);
+	if (max_bytes > 0) {
+		size_t byte_nodes = std::max(max_bytes / node_bytes, size_t(1));
+		max_nodes = max_nodes > 0 ? std::min(max_nodes, byte_nodes) :
+			byte_nodes;
+	}
+	if (backend == "hashed" && max_nodes == 0) {
+		max_nodes = hashed_default_entries;
+	}
+
+	ContextTree *ct;
+	if (model == "single") {
+		ct = createTree(backend, format, depth, revert_bits, journal,
+			max_nodes, lazy, huge_pages, saved);
+	} else if (model == "factored") {
+		std::vector<ContextTree *> trees;
+		size_t bit_max_nodes = max_nodes > 0 ?
+			std::max(max_nodes / percept_bits, size_t(1)) : 0;
+		for (int i = 1; i <= percept_bits; i++) {
+			int bit_depth = context.empty() ? getOption<int>(options,
+				"ct-depth-" + toString(i), depth) : depth;
+			trees.push_back(createTree(backend, format, bit_depth,
+				revert_bits, journal, bit_max_nodes, lazy, huge_pages));
+		}
+		int threads = getOption<int>(options, "ct-threads", 1);
+		if (threads < 1) {
+			std::cerr << "ERROR: ct-threads must be positive" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		ct = new FactoredContextTree(trees, revert_bits, threads);
+	} else {
+		std::cerr << "ERROR: unknown ct-model '" << model << "'"
+			<< std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (!context.empty()) {
+		ct->selectContext(context);
+	}
+
+	options["ct-node-bytes"] = toString(node_bytes);
+	options["ct-node-bytes-saved"] = toString(int(sizeof(CTNode)) -
+		int(node_bytes));
+	options["ct-log-add-error"] = toString(log_add_error);
+
+	// The first slab of each tree has been allocated and its root touched.
+	if (huge_pages) {
+		size_t requested, obtained;
+		hugePageUsage(requested, obtained);
+		options["huge-page-bytes"] = toString(requested);
+		options["huge-page-bytes-obtained"] = toString(obtained);
+	}
+	return ct;
 }
 
 
@@ -159,28 +825,6 @@ void ContextTree::updateHistory(symbol_list_t const& symbols) {
 }
 
 
-// Revert the most recent update.
-void ContextTree::revert(void) {
-
-	// No updates to revert // TODO: maybe this should be an assertion?
-	if (m_history.size() == 0)
-		return;
-
-	// Get the most recent symbol and delete from history
-	const symbol_t symbol = m_history.back();
-	m_history.pop_back();
-
-	// Traverse the tree from leaf to root according to the context. Update the
-	// probabilities and symbol counts for each node. Delete unnecessary nodes.
-	if (m_history.size() >= m_depth) {
-		updateContext();
-		for (int i = m_depth; i >= 0; i--) {
-			m_context[i]->revert(symbol);
-		}
-	}
-}
-
-
 // Revert multiple updates
 void ContextTree::revert(const int num_symbols) {
 	for(int i = 0; i < num_symbols; i++) {
@@ -197,19 +841,17 @@ void ContextTree::revertHistory(const int num_symbols) {
 
 
 // The conditional probability of symbol given the history
-weight_t ContextTree::predict(const symbol_t symbol) {
+weight_t ContextTree::predict(const symbol_t symbol) const {
 
 	// If there is insufficient context for a prediction return 1/2.
-	if (m_history.size() < m_depth) {
+	if (m_history.size() < m_context_span) {
 		return 0.5;
 	}
 
 	// Calculate the probability of the symbol s given the history h using
 	// p(s | h) = p(hs) / p(h) = exp(ln p(hs) - ln p(h)).
 	weight_t prob_history = logBlockProbability();
-	update(symbol);
-	weight_t prob_sequence = logBlockProbability();
-	revert();
+	weight_t prob_sequence = logBlockProbabilityAfter(symbol);
 	return std::exp(prob_sequence - prob_history);
 }
 
@@ -219,7 +861,7 @@ weight_t ContextTree::predict(symbol_list_t const& symbols) {
 
 	// If there is insufficient context for a prediction, return the uniform
 	// prediction 0.5^length
-	if (m_history.size() + symbols.size() <= m_depth) {
+	if (m_history.size() + symbols.size() <= m_context_span) {
 		return pow(0.5, (int) symbols.size());
 	}
 
@@ -233,6 +875,81 @@ weight_t ContextTree::predict(symbol_list_t const& symbols) {
 	return std::exp(prob_sequence - prob_history);
 }
 
+
+// Orders sequence predictions so that the standard heap functions keep the
+// least probable at the front.
+static bool moreProbable(const SequencePrediction &a,
+		const SequencePrediction &b) {
+	return a.probability > b.probability;
+}
+
+
+// The conditional probability of every sequence of a given length, or of the
+// most probable ones
+void ContextTree::predictSequences(const int bits,
+		std::vector<SequencePrediction> &predictions, const size_t limit) {
+	assert(0 < bits && bits <= (limit == 0 ? cMaxSequenceBits : 31));
+
+	predictions.clear();
+	if (limit == 0) predictions.resize(size_t(1) << bits);
+	else predictions.reserve(limit);
+	predictSequences(bits, 0, 0, 1.0, predictions, limit);
+
+	// The heap is turned into a list, most probable first.
+	if (limit != 0) {
+		std::sort_heap(predictions.begin(), predictions.end(), moreProbable);
+	}
+}
+
+
+// Each prefix is added to the tree once, and reverted once its extensions
+// have been enumerated. The last symbol is never added, as predicting it is
+// enough. The more probable symbol is tried first, so that with a limit the
+// best sequences are found early and more of the rest can be skipped.
+void ContextTree::predictSequences(const int bits, const int position,
+		const uint32_t prefix, const weight_t probability,
+		std::vector<SequencePrediction> &predictions, const size_t limit) {
+	const weight_t prob_one = predict(true);
+	const symbol_t first = prob_one >= 0.5;
+	for (int i = 0; i < 2; i++) {
+		const symbol_t symbol = i == 0 ? first : !first;
+		const weight_t prob_symbol = symbol ? prob_one : 1.0 - prob_one;
+		const weight_t prob_sequence = probability * prob_symbol;
+		const uint32_t sequence = prefix | (uint32_t(symbol) << position);
+
+		// With a limit, sequences no more probable than the least of a full
+		// heap are skipped. Extending a sequence cannot make it more probable,
+		// and the second symbol is no more probable than the first.
+		if (limit != 0 && predictions.size() == limit
+				&& prob_sequence <= predictions.front().probability) {
+			return;
+		}
+
+		if (position + 1 < bits) {
+			update(symbol);
+			predictSequences(bits, position + 1, sequence, prob_sequence,
+				predictions, limit);
+			revert();
+		} else if (limit == 0) {
+			predictions[sequence].sequence = sequence;
+			predictions[sequence].probability = prob_sequence;
+		} else {
+			if (predictions.size() == limit) {
+				std::pop_heap(predictions.begin(), predictions.end(),
+					moreProbable);
+				predictions.pop_back();
+			}
+			SequencePrediction prediction;
+			prediction.sequence = sequence;
+			prediction.probability = prob_sequence;
+			predictions.push_back(prediction);
+			std::push_heap(predictions.begin(), predictions.end(),
+				moreProbable);
+		}
+	}
+}
+
+
 void ContextTree::genRandomSymbols(symbol_list_t &symbols, const int bits) {
 
 	genRandomSymbolsAndUpdate(symbols, bits);
@@ -246,34 +963,1712 @@ void ContextTree::genRandomSymbolsAndUpdate(symbol_list_t &symbols, const int bi
 
 	symbols.resize(bits);
 	for (int i = 0; i < bits; i++) {
-		symbols[i] = rand01() < predict(true);
-		update(symbols[i]);
+		symbols[i] = genRandomSymbolAndUpdate();
 	}
 }
 
 
-// the logarithm of the block probability of the whole sequence
-double ContextTree::logBlockProbability(void) const {
-	return m_root->logProbability();
+// The weighted probability a chain node would have after an update. If the
+// context follows the chain, it stays a chain and this is its KT estimate.
+// Otherwise the nodes down to where the two diverge are expanded: the deepest
+// mixes its KT estimate with the rest of the chain and a new leaf, and each
+// one above it mixes its KT estimate with the one below.
+template <class Node>
+double ArenaContextTree<Node>::chainProbabilityAfter(const Node &node,
+		const int agreement, const int levels, const symbol_t symbol) {
+	double log_kt = node.logKTAfter(symbol);
+	if (agreement == levels) {
+		return log_kt;
+	}
+	double log_probability = logMixture(log_kt, node.logKT() + log_half);
+	for (int i = 0; i < agreement; i++) {
+		log_probability = logMixture(log_kt, log_probability);
+	}
+	return log_probability;
 }
 
 
-// Get the nodes in the current context
-void ContextTree::updateContext(void) {
-	assert(m_history.size() >= m_depth);
+template <class Node>
+ArenaContextTree<Node>::ArenaContextTree(const int depth,
+		const size_t revert_bits, const bool journal, const size_t max_nodes,
+		const bool lazy, const bool huge_pages, ModelFile *model) :
+	ContextTree(depth, revert_bits),
+	m_journal_capacity(journal ? revert_bits : 0), m_journal_size(0),
+	m_journal_next(0), m_max_nodes(max_nodes), m_lazy(lazy), m_model(model)
+{
+	// Adopt the saved nodes and replay the saved history, oldest first.
+	m_nodes.useHugePages(huge_pages);
+	if (m_model) {
+		const ModelHeader &header = m_model->header();
+		assert(int(header.depth) == m_depth);
+		Node *nodes = static_cast<Node *>(m_model->nodes());
+		m_root = arena_index_t(header.root);
+		if (!countSavedNodes(nodes)) {
+			std::cerr << "ERROR: cannot load model: nodes corrupt" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		m_nodes.attach(nodes, size_t(header.node_count));
+		const uint64_t *words = m_model->history();
+		for (size_t age = size_t(header.history_size); age-- > 0; ) {
+			m_history.push_back(((words[age / 64] >> (age % 64)) & 1) != 0);
+		}
+	} else {
+		m_root = m_nodes.allocate();
+		m_counts.created(0);
+	}
 
-	// Traverse the tree from root to leaf according to the context. Save the
-	// path taken and create new nodes as necessary.
-	m_context[0] = m_root;
-	CTNode **node = &m_root;
-	symbol_list_t::reverse_iterator symbol_iter = m_history.rbegin();
-	for (int i = 1; i <= m_depth; symbol_iter++, i++) {
-		// Address of the pointer to the relevant child node
-		node = &((*node)->m_child[*symbol_iter]);
+	m_context = new Node*[m_depth + 1];
+	m_path = new arena_index_t[m_depth + 1];
+	m_log_kt_after = new weight_t[m_depth + 1];
+	m_log_probability_after = new weight_t[m_depth + 1];
+
+	// An empty node's children are empty too, down to the maximum depth.
+	static const Node empty;
+	m_log_empty_after = new weight_t[m_depth + 1];
+	for (int level = m_depth; level >= 0; level--) {
+		double log_kt = empty.logKTAfter(false);
+		m_log_empty_after[level] = level == m_depth ? log_kt :
+			logMixture(log_kt, m_log_empty_after[level + 1] + 0.0);
+	}
 
-		// Add node to the path (creating it if it does not exist)
-		if (*node == NULL)
-			*node = new CTNode();
-		m_context[i] = *node;
+	m_journal_nodes = new Node[m_journal_capacity * (m_depth + 1)];
+	m_journal_path = new arena_index_t[m_journal_capacity * (m_depth + 1)];
+	m_journal_created = new int[m_journal_capacity];
+	m_journal_leaf = new int[m_journal_capacity];
+	m_journal_orphan = new arena_index_t[m_journal_capacity];
+	m_journal_orphan_level = new int[m_journal_capacity];
+}
+
+
+// Delete tree and history. The nodes are freed with the arena.
+template <class Node>
+ArenaContextTree<Node>::~ArenaContextTree(void) {
+	m_history.clear();
+	delete[] m_context;
+	delete[] m_path;
+	delete[] m_log_kt_after;
+	delete[] m_log_probability_after;
+	delete[] m_log_empty_after;
+	delete[] m_journal_nodes;
+	delete[] m_journal_path;
+	delete[] m_journal_created;
+	delete[] m_journal_leaf;
+	delete[] m_journal_orphan;
+	delete[] m_journal_orphan_level;
+	delete m_model;
+}
+
+
+// Clear tree and history.
+template <class Node>
+void ArenaContextTree<Node>::clear(void) {
+	m_history.clear();
+	m_nodes.clear();
+	m_counts.clear();
+	m_root = m_nodes.allocate();
+	m_counts.created(0);
+	m_journal_size = 0;
+}
+
+
+// Update the tree with a single new symbol.
+template <class Node>
+void ArenaContextTree<Node>::update(const symbol_t symbol) {
+
+	// Traverse the tree from leaf to root according to the context. Update the
+	// probabilities and symbol counts for each node.
+	if (m_history.size() >= m_context_span) {
+		updateContext(m_lazy);
+		journal();
+		for (int i = m_leaf; i >= 0; i--) {
+			m_context[i]->update(symbol, m_nodes);
+		}
+	}
+
+	// Add symbol to history
+	updateHistory(symbol);
+}
+
+
+// Revert the most recent update.
+template <class Node>
+void ArenaContextTree<Node>::revert(void) {
+
+	// No updates to revert // TODO: maybe this should be an assertion?
+	if (m_history.size() == 0)
+		return;
+
+	// Get the most recent symbol and delete from history
+	const symbol_t symbol = m_history.back();
+	m_history.pop_back();
+
+	// Restore the nodes from the journal if the update was recorded.
+	// Otherwise traverse the tree from leaf to root according to the context,
+	// update the probabilities and symbol counts for each node and delete
+	// unnecessary nodes.
+	if (m_history.size() >= m_context_span) {
+		if (m_journal_size > 0) {
+			restore();
+			return;
+		}
+		updateContext(m_lazy);
+		for (int i = m_leaf; i >= 0; i--) {
+			Node &node = *m_context[i];
+			int released = node.revert(symbol, m_nodes);
+			if (released > 0) m_counts.released(i + 1, released);
+
+			// Join the levels the update split off a chain, bottom up, so
+			// that the tree is as if the update had never happened.
+			if (!m_lazy || i == 0 || m_depth - i > Node::cChainLevels ||
+					!node.linksChildren())
+				continue;
+			const arena_index_t child = node.m_child[0] ? node.m_child[0] :
+				node.m_child[1];
+			if (child && node.mergeChain(m_nodes[child], i, m_depth)) {
+				m_nodes.release(child);
+				m_counts.released(i + 1);
+			}
+		}
+	}
+}
+
+
+// the logarithm of the block probability of the whole sequence
+template <class Node>
+double ArenaContextTree<Node>::logBlockProbability(void) const {
+	return m_nodes[m_root].logProbability();
+}
+
+
+// The log block probability after a hypothetical update with symbol.
+template <class Node>
+double ArenaContextTree<Node>::logBlockProbabilityAfter(
+		const symbol_t symbol) const {
+	assert(m_history.size() >= m_context_span);
+	return logProbabilityAfter(m_root, 0, symbol);
+}
+
+
+// Mirrors Node::update() applied along the context path, without touching
+// the nodes. The path below the deepest existing node is empty and needs no
+// walking.
+template <class Node>
+double ArenaContextTree<Node>::logProbabilityAfter(const arena_index_t index,
+		const int level, const symbol_t symbol) const {
+	if (index == null_index) return m_log_empty_after[level];
+	const Node &node = m_nodes[index];
+
+	double log_kt = node.logKTAfter(symbol);
+	if (level == m_depth || node.isPruned()) {
+		return log_kt;
+	}
+	if (node.isChain()) {
+		return chainProbabilityAfter(node,
+			node.chainAgreement(m_history, level, m_depth), m_depth - level,
+			symbol);
+	}
+
+	// The child on the context path is updated; its sibling is unchanged.
+	const symbol_t context = m_history.contextSymbol(level);
+	double log_child_prob = logProbabilityAfter(node.child(context),
+		level + 1, symbol);
+	arena_index_t sibling = node.child(!context);
+	log_child_prob += sibling ? m_nodes[sibling].logProbability() : 0.0;
+	return logMixture(log_kt, log_child_prob);
+}
+
+
+// Sample a symbol and update the tree with it in a single walk of the path.
+template <class Node>
+symbol_t ArenaContextTree<Node>::genRandomSymbolAndUpdate(void) {
+
+	// With insufficient context the prediction is 1/2 and the tree is not
+	// updated.
+	if (m_history.size() < m_context_span) {
+		const symbol_t symbol = rand01() < 0.5;
+		updateHistory(symbol);
+		return symbol;
+	}
+
+	// Compute the state of each node on the path after a one, from leaf to
+	// root, as logProbabilityAfter() does. A novel context ends at a single
+	// chain node.
+	updateContext(true);
+	for (int i = m_leaf; i >= 0; i--) {
+		m_log_kt_after[i] = m_context[i]->logKTAfter(true);
+		if (i == m_leaf) {
+			m_log_probability_after[i] = m_log_kt_after[i];
+			continue;
+		}
+		const symbol_t context = m_history.contextSymbol(i);
+		double log_child_prob = m_log_probability_after[i + 1];
+		arena_index_t sibling = m_context[i]->child(!context);
+		log_child_prob += sibling ? m_nodes[sibling].logProbability() : 0.0;
+		m_log_probability_after[i] = logMixture(m_log_kt_after[i],
+			log_child_prob);
+	}
+
+	// Sample, then commit the precomputed state for a one or update the path
+	// for a zero.
+	weight_t prob_one = std::exp(m_log_probability_after[0] -
+		logBlockProbability());
+	const symbol_t symbol = rand01() < prob_one;
+	journal();
+	for (int i = m_leaf; i >= 0; i--) {
+		if (symbol) {
+			m_context[i]->update(symbol, m_log_kt_after[i],
+				m_log_probability_after[i]);
+		} else {
+			m_context[i]->update(symbol, m_nodes);
+		}
+	}
+
+	updateHistory(symbol);
+	return symbol;
+}
+
+
+// The number of nodes in the tree, counted as they are created and released.
+template <class Node>
+size_t ArenaContextTree<Node>::size(void) const {
+	assert(m_counts.total() == m_nodes.size());
+	return m_counts.total();
+}
+
+
+// Count the nodes adopted from a saved model by depth, without recursing so
+// that a deep tree cannot overflow the stack. The file is not trusted: the
+// links are checked before they are followed, so that a corrupt file cannot
+// lead the walk outside the nodes or around a cycle. A saved tree is
+// compacted, so it must reach every node.
+template <class Node>
+bool ArenaContextTree<Node>::countSavedNodes(const Node *nodes) {
+	const size_t slots = size_t(m_model->header().node_count);
+	std::vector<bool> reached(slots, false);
+	reached[m_root] = true;
+	size_t count = 0;
+	std::vector<std::pair<arena_index_t, int> > stack;
+	stack.push_back(std::make_pair(m_root, 0));
+	while (!stack.empty()) {
+		const Node &node = nodes[stack.back().first];
+		const int level = stack.back().second;
+		stack.pop_back();
+		m_counts.adopt(level);
+		count++;
+		if (node.isChain() && m_depth - level > Node::cChainLevels)
+			return false;
+		for (int c = 0; c < 2 && node.linksChildren(); c++) {
+			const arena_index_t child = node.child(c);
+			if (child == null_index)
+				continue;
+			if (level == m_depth || child >= slots || reached[child])
+				return false;
+			reached[child] = true;
+			stack.push_back(std::make_pair(child, level + 1));
+		}
+	}
+	return count == slots - 1;
+}
+
+
+// Cut off the least visited subtrees once the tree outgrows its budget.
+template <class Node>
+size_t ArenaContextTree<Node>::prune(void) {
+	if (m_max_nodes == 0 || m_nodes.size() <= m_max_nodes)
+		return 0;
+
+	// Leave some room to grow, so that the tree is not pruned every cycle.
+	size_t target = m_max_nodes - m_max_nodes / 10;
+	size_t excess = m_nodes.size() - target;
+
+	// Find the fewest visits at which pruning releases enough nodes. The
+	// count is an estimate when the compact format has halved some counts.
+	std::map<int, size_t> released;
+	countPrunable(m_root, released);
+	int max_visits = 0;
+	size_t total = 0;
+	std::map<int, size_t>::const_iterator it;
+	for (it = released.begin(); it != released.end(); it++) {
+		max_visits = it->first;
+		total += it->second;
+		if (total >= excess) break;
+	}
+
+	// Prune every node with fewer visits, then only as many of those with
+	// exactly that many visits as are needed to reach the target.
+	size_t before = m_nodes.size();
+	pruneSubtree(m_root, 0, max_visits - 1, target);
+	pruneSubtree(m_root, 0, max_visits, target);
+	m_journal_size = 0;
+	return before - m_nodes.size();
+}
+
+
+// Pruning a node releases its children and their descendants. Children of the
+// root are counted separately from their descendants since the root stays.
+// The walk keeps its own stack, since a context path may be thousands of nodes
+// deep.
+template <class Node>
+void ArenaContextTree<Node>::countPrunable(const arena_index_t index,
+		std::map<int, size_t> &released) const {
+	std::vector<arena_index_t> stack(1, index);
+	while (!stack.empty()) {
+		const arena_index_t parent = stack.back();
+		stack.pop_back();
+		const Node &node = m_nodes[parent];
+		if (node.isLeafNode()) continue;
+		for (int c = 0; c < 2; c++) {
+			arena_index_t child = node.child(c);
+			if (child == null_index) continue;
+			if (parent != m_root) released[node.visits()]++;
+			stack.push_back(child);
+		}
+	}
+}
+
+
+// Prune from the top down, recomputing the weighted probabilities of the
+// ancestors of pruned nodes on the way back up. The nodes are visited in the
+// same order as a recursive walk, so the same ones are pruned before the
+// target is reached.
+template <class Node>
+bool ArenaContextTree<Node>::pruneSubtree(const arena_index_t index,
+		const int level, const int max_visits, const size_t target) {
+	std::vector<PruneFrame> stack;
+	PruneFrame top = { index, level, 0, false };
+	bool changed = false;
+	for (;;) {
+		Node &node = m_nodes[top.index];
+		if (node.isLeafNode() || m_nodes.size() <= target) {
+			changed = false;
+		} else if (top.index != m_root && node.visits() <= max_visits) {
+			releaseChildren(top.index, top.level);
+			node.m_child[0] = pruned_index;
+			node.m_child[1] = pruned_index;
+			node.updateLogProbability(m_nodes);
+			changed = true;
+		} else {
+			stack.push_back(top);
+			changed = false;
+		}
+
+		// Finish the nodes whose children have all been visited, and move
+		// on to the next child.
+		for (;;) {
+			if (stack.empty()) return changed;
+			PruneFrame &frame = stack.back();
+			if (changed) frame.changed = true;
+			Node &parent = m_nodes[frame.index];
+			while (frame.next < 2 && !parent.m_child[frame.next]) {
+				frame.next++;
+			}
+			if (frame.next < 2) {
+				top.index = parent.m_child[frame.next++];
+				top.level = frame.level + 1;
+				break;
+			}
+			changed = frame.changed;
+			if (changed) parent.updateLogProbability(m_nodes);
+			stack.pop_back();
+		}
+	}
+}
+
+
+template <class Node>
+void ArenaContextTree<Node>::releaseChildren(const arena_index_t index,
+		const int level) {
+	Node &node = m_nodes[index];
+	if (!node.linksChildren()) return;
+	std::vector<std::pair<arena_index_t, int> > stack;
+	for (int c = 0; c < 2; c++) {
+		if (node.m_child[c]) {
+			stack.push_back(std::make_pair(node.m_child[c], level + 1));
+			node.m_child[c] = null_index;
+		}
+	}
+	while (!stack.empty()) {
+		const arena_index_t child = stack.back().first;
+		const int child_level = stack.back().second;
+		stack.pop_back();
+		const Node &released = m_nodes[child];
+		for (int c = 0; c < 2 && released.linksChildren(); c++) {
+			if (released.m_child[c]) {
+				stack.push_back(std::make_pair(released.m_child[c],
+					child_level + 1));
+			}
+		}
+		m_nodes.release(child);
+		m_counts.released(child_level);
+	}
+}
+
+
+// Number the nodes in the order a stack-based walk first reaches them.
+template <class Node>
+void ArenaContextTree<Node>::depthFirstOrder(std::vector<arena_index_t> &order,
+		std::vector<arena_index_t> &number) const {
+	order.assign(1, null_index);
+	number.assign(m_nodes.capacity() + 1, null_index);
+	std::vector<arena_index_t> stack(1, m_root);
+	while (!stack.empty()) {
+		arena_index_t index = stack.back();
+		stack.pop_back();
+		number[index] = arena_index_t(order.size());
+		order.push_back(index);
+		const Node &node = m_nodes[index];
+		if (!node.linksChildren()) continue;
+
+		// The child pushed last is numbered next.
+		int first = 0;
+		if (node.child(0) == null_index || (node.child(1) != null_index &&
+				m_nodes[node.child(1)].visits() >
+				m_nodes[node.child(0)].visits()))
+			first = 1;
+		if (node.child(1 - first)) stack.push_back(node.child(1 - first));
+		if (node.child(first)) stack.push_back(node.child(first));
+	}
+}
+
+
+// Rebuild the arena with the nodes in depth-first order. The new arena
+// allocates indices 1, 2, ... in turn, so node i of the order gets index i.
+template <class Node>
+bool ArenaContextTree<Node>::compact(void) {
+	std::vector<arena_index_t> order, number;
+	depthFirstOrder(order, number);
+
+	Arena<Node> nodes;
+	nodes.useHugePages(m_nodes.hugePages());
+	for (size_t i = 1; i < order.size(); i++) {
+		arena_index_t index = nodes.allocate();
+		assert(index == i);
+		Node &node = nodes[index];
+		node = m_nodes[order[i]];
+		if (node.linksChildren()) {
+			for (int c = 0; c < 2; c++) {
+				node.m_child[c] = number[node.m_child[c]];
+			}
+		}
+	}
+	m_nodes.swap(nodes);
+	m_root = number[m_root];
+	m_journal_size = 0;
+
+	// No node is borrowed from the saved model any more.
+	delete m_model;
+	m_model = NULL;
+	return true;
+}
+
+
+// Each update walks the path from the root, through a node as many times as
+// the node has been visited, and jumps whenever a child is on neither its
+// parent's cache line nor the next one.
+template <class Node>
+double ArenaContextTree<Node>::pathCost(void) const {
+	double root_visits = m_nodes[m_root].visits();
+	if (root_visits == 0) return 0.0;
+
+	double jumps = 0.0;
+	std::vector<arena_index_t> stack(1, m_root);
+	while (!stack.empty()) {
+		const Node &node = m_nodes[stack.back()];
+		stack.pop_back();
+		if (!node.linksChildren()) continue;
+		uintptr_t line = reinterpret_cast<uintptr_t>(&node) / 64;
+		for (int c = 0; c < 2; c++) {
+			if (node.child(c) == null_index) continue;
+			const Node &child = m_nodes[node.child(c)];
+			uintptr_t child_line = reinterpret_cast<uintptr_t>(&child) / 64;
+			if (child_line != line && child_line != line + 1)
+				jumps += child.visits();
+			stack.push_back(node.child(c));
+		}
+	}
+	return jumps / root_visits;
+}
+
+
+// The node arena, whether or not its slots are in use, and the journal.
+template <class Node>
+size_t ArenaContextTree<Node>::memoryUsage(void) const {
+	size_t journal = m_journal_capacity * (m_depth + 1) *
+		(sizeof(Node) + sizeof(arena_index_t));
+	return m_nodes.capacity() * sizeof(Node) + journal;
+}
+
+
+// Get the nodes in the current context
+template <class Node>
+void ArenaContextTree<Node>::updateContext(const bool lazy) {
+	assert(m_history.size() >= m_context_span);
+
+	// Traverse the tree from root to leaf according to the context. Save the
+	// path taken and create new nodes as necessary. Slabs never move, so
+	// pointers into the arena stay valid while new nodes are allocated.
+	// The context is read from the history 64 symbols at a time, most
+	// recent first. The path ends early at a pruned node or a chain node.
+	Node *node = &m_nodes[m_root];
+	m_context[0] = node;
+	m_path[0] = m_root;
+	m_leaf = m_depth;
+	m_created = m_depth + 1;
+	m_expanded = -1;
+	m_orphan = null_index;
+	m_orphan_level = -1;
+	uint64_t context = 0;
+	for (int i = 1; i <= m_depth; i++, context >>= 1) {
+		if (node->isPruned()) {
+			m_leaf = i - 1;
+			m_created = std::min(m_created, i);
+			break;
+		}
+		if (node->isChain()) {
+			if (node->chainAgreement(m_history, i - 1, m_depth) ==
+					m_depth - i + 1) {
+				m_leaf = i - 1;
+				m_created = std::min(m_created, i);
+				break;
+			}
+
+			// Only a chain which existed before this update is journaled;
+			// the rest of it is created here, on the path or off it.
+			if (i - 1 < m_created) {
+				m_expanded = i - 1;
+				m_expanded_node = *node;
+			}
+			const arena_index_t rest = m_nodes.allocate();
+			m_counts.created(i);
+			node->expandChain(m_nodes[rest], rest, i - 1, m_depth);
+			m_orphan = rest;
+			m_orphan_level = i;
+		}
+		if ((i - 1) % 64 == 0) context = m_history.context(i - 1);
+		const symbol_t symbol = (context & 1) != 0;
+
+		// Add node to the path (creating it if it does not exist)
+		arena_index_t child = node->m_child[symbol];
+		if (child == m_orphan) {
+			m_orphan = null_index;
+			m_created = std::min(m_created, i);
+		}
+		if (child == null_index) {
+			child = m_nodes.allocate();
+			m_counts.created(i);
+			node->m_child[symbol] = child;
+			m_created = std::min(m_created, i);
+			if (lazy && i < m_depth && m_depth - i <= Node::cChainLevels) {
+				m_nodes[child].makeChain(m_history, i, m_depth);
+				m_context[i] = &m_nodes[child];
+				m_path[i] = child;
+				m_leaf = i;
+				break;
+			}
+		}
+		node = &m_nodes[child];
+		m_context[i] = node;
+		m_path[i] = child;
+	}
+}
+
+
+// Record the nodes on the current context path before they are updated.
+template <class Node>
+void ArenaContextTree<Node>::journal(void) {
+	if (m_journal_capacity == 0) return;
+
+	// The nodes created by updateContext() need no saving. Their parent
+	// already links to the first of them, which must be undone in its copy,
+	// unless the parent was a chain and is saved as it was.
+	size_t base = m_journal_next * (m_depth + 1);
+	for (int i = 0; i < m_created; i++) {
+		m_journal_nodes[base + i] = i == m_expanded ? m_expanded_node :
+			*m_context[i];
+		m_journal_path[base + i] = m_path[i];
+	}
+	if (m_created <= m_leaf) {
+		Node &parent = m_journal_nodes[base + m_created - 1];
+		for (int c = 0; c < 2 && parent.linksChildren(); c++) {
+			if (parent.m_child[c] == m_path[m_created])
+				parent.m_child[c] = null_index;
+		}
+		for (int i = m_created; i <= m_leaf; i++) {
+			m_journal_path[base + i] = m_path[i];
+		}
+	}
+	m_journal_created[m_journal_next] = m_created;
+	m_journal_leaf[m_journal_next] = m_leaf;
+	m_journal_orphan[m_journal_next] = m_orphan;
+	m_journal_orphan_level[m_journal_next] = m_orphan_level;
+
+	m_journal_next = (m_journal_next + 1) % m_journal_capacity;
+	m_journal_size = std::min(m_journal_size + 1, m_journal_capacity);
+}
+
+
+// Undo the most recent journaled update by copying back the saved nodes and
+// releasing those it created.
+template <class Node>
+void ArenaContextTree<Node>::restore(void) {
+	assert(m_journal_size > 0);
+	m_journal_next = (m_journal_next + m_journal_capacity - 1) %
+		m_journal_capacity;
+	m_journal_size--;
+
+	size_t base = m_journal_next * (m_depth + 1);
+	int created = m_journal_created[m_journal_next];
+	for (int i = m_journal_leaf[m_journal_next]; i >= created; i--) {
+		m_nodes.release(m_journal_path[base + i]);
+		m_counts.released(i);
+	}
+	if (m_journal_orphan[m_journal_next] != null_index) {
+		m_nodes.release(m_journal_orphan[m_journal_next]);
+		m_counts.released(m_journal_orphan_level[m_journal_next]);
+	}
+	for (int i = created - 1; i >= 0; i--) {
+		m_nodes[m_journal_path[base + i]] = m_journal_nodes[base + i];
+	}
+}
+
+
+
+// Write the header, the most recent m_depth symbols of the history and the
+// nodes, renumbered in depth-first order.
+template <class Node>
+bool ArenaContextTree<Node>::save(const std::string &path) const {
+
+	std::vector<arena_index_t> order, number;
+	depthFirstOrder(order, number);
+
+	ModelHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::strncpy(header.node_format, formatName(static_cast<Node *>(NULL)),
+		sizeof(header.node_format) - 1);
+	header.node_bytes = sizeof(Node);
+	header.depth = uint32_t(m_depth);
+	header.node_count = order.size();
+	header.root = number[m_root];
+	header.history_size = std::min(m_history.size(), size_t(m_depth));
+	ModelFile::layout(header);
+
+	std::vector<uint64_t> history((header.history_size + 63) / 64);
+	for (size_t k = 0; k < history.size(); k++) {
+		uint64_t word = m_history.recent(k * 64);
+		size_t bits = size_t(header.history_size) - k * 64;
+		if (bits < 64) word &= (uint64_t(1) << bits) - 1;
+		history[k] = word;
+	}
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	std::vector<char> padding(header.nodes_offset, 0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.write(&padding[0], header.history_offset - sizeof(header));
+	if (!history.empty()) {
+		out.write(reinterpret_cast<const char *>(&history[0]),
+			history.size() * sizeof(uint64_t));
+	}
+	out.write(&padding[0], header.nodes_offset - header.history_offset -
+		history.size() * sizeof(uint64_t));
+
+	// Slot null_index is written as an empty node.
+	Node node;
+	out.write(reinterpret_cast<const char *>(&node), sizeof(Node));
+	for (size_t i = 1; i < order.size(); i++) {
+		node = m_nodes[order[i]];
+		if (node.linksChildren()) {
+			for (int c = 0; c < 2; c++) {
+				node.m_child[c] = number[node.m_child[c]];
+			}
+		}
+		out.write(reinterpret_cast<const char *>(&node), sizeof(Node));
+	}
+	out.close();
+	return !out.fail();
+}
+
+
+// An overlay reads the nodes of this tree.
+template <class Node>
+ContextTree *ArenaContextTree<Node>::createOverlay(void) const {
+	return new OverlayContextTree<Node>(*this);
+}
+
+
+
+
+template <class Node>
+OverlayContextTree<Node>::OverlayContextTree(
+		const ArenaContextTree<Node> &base) :
+	ContextTree(base), m_base(base),
+	m_base_revision(base.m_history.revision()), m_root(base.m_root),
+	m_context(m_depth + 1), m_leaf(m_depth), m_log_kt_after(m_depth + 1),
+	m_log_probability_after(m_depth + 1)
+{
+	m_nodes.useHugePages(base.m_nodes.hugePages());
+}
+
+
+// Discard every change made through the overlay.
+template <class Node>
+void OverlayContextTree<Node>::clear(void) {
+	assert(m_base.m_nodes.capacity() < cOverlayBit);
+
+	// Symbols added through the overlay are newer than the shared tree's, and
+	// no more than the history keeps for reverting, so dropping them leaves
+	// the shared tree's symbols.
+	if (m_base.m_history.revision() == m_base_revision) {
+		m_history.resize(m_base.m_history.size());
+	} else {
+		m_history = m_base.m_history;
+		m_base_revision = m_base.m_history.revision();
+	}
+	m_nodes.clear();
+	m_root = m_base.m_root;
+	m_journal.clear();
+	m_journal_marks.clear();
+}
+
+
+// Update the overlay with a single new symbol.
+template <class Node>
+void OverlayContextTree<Node>::update(const symbol_t symbol) {
+	if (m_history.size() >= m_context_span) {
+		copyContext(m_base.m_lazy);
+		updatePath(symbol);
+	}
+	updateHistory(symbol);
+}
+
+
+// Revert the most recent update from the journal.
+template <class Node>
+void OverlayContextTree<Node>::revert(void) {
+	if (m_history.size() == 0)
+		return;
+	m_history.pop_back();
+	if (m_history.size() < m_context_span)
+		return;
+
+	// Entries are undone from leaf to root, so children are released before
+	// the links to them are restored.
+	assert(!m_journal_marks.empty()); // not an update made through the overlay
+	size_t mark = m_journal_marks.back();
+	m_journal_marks.pop_back();
+	while (m_journal.size() > mark) {
+		const JournalEntry &entry = m_journal.back();
+		if (entry.allocated) {
+			m_nodes.release(entry.index);
+			if (m_root == (entry.index | cOverlayBit))
+				m_root = m_base.m_root;
+		} else {
+			m_nodes[entry.index] = entry.saved;
+		}
+		m_journal.pop_back();
+	}
+}
+
+
+// Sample a symbol and update the overlay with it, as
+// ArenaContextTree::genRandomSymbolAndUpdate() does.
+template <class Node>
+symbol_t OverlayContextTree<Node>::genRandomSymbolAndUpdate(void) {
+	if (m_history.size() < m_context_span) {
+		const symbol_t symbol = rand01() < 0.5;
+		updateHistory(symbol);
+		return symbol;
+	}
+
+	copyContext(true);
+	for (int i = m_leaf; i >= 0; i--) {
+		m_log_kt_after[i] = m_context[i]->logKTAfter(true);
+		if (i == m_leaf) {
+			m_log_probability_after[i] = m_log_kt_after[i];
+			continue;
+		}
+		const symbol_t context = m_history.contextSymbol(i);
+		double log_child_prob = m_log_probability_after[i + 1];
+		arena_index_t sibling = m_context[i]->child(!context);
+		log_child_prob += sibling ? node(sibling).logProbability() : 0.0;
+		m_log_probability_after[i] = logMixture(m_log_kt_after[i],
+			log_child_prob);
+	}
+
+	weight_t prob_one = std::exp(m_log_probability_after[0] -
+		logBlockProbability());
+	const symbol_t symbol = rand01() < prob_one;
+	if (symbol) {
+		for (int i = m_leaf; i >= 0; i--) {
+			m_context[i]->update(symbol, m_log_kt_after[i],
+				m_log_probability_after[i]);
+		}
+	} else {
+		updatePath(symbol);
+	}
+
+	updateHistory(symbol);
+	return symbol;
+}
+
+
+template <class Node>
+double OverlayContextTree<Node>::logBlockProbability(void) const {
+	return node(m_root).logProbability();
+}
+
+
+template <class Node>
+double OverlayContextTree<Node>::logBlockProbabilityAfter(
+		const symbol_t symbol) const {
+	assert(m_history.size() >= m_context_span);
+	return logProbabilityAfter(m_root, 0, symbol);
+}
+
+
+// The number of nodes in the tree seen through the overlay.
+template <class Node>
+size_t OverlayContextTree<Node>::size(void) const {
+	return size(m_root);
+}
+
+
+// The overlay shares the nodes of the shared tree, so only its own arena is
+// counted.
+template <class Node>
+size_t OverlayContextTree<Node>::memoryUsage(void) const {
+	return m_nodes.capacity() * sizeof(Node) +
+		m_journal.capacity() * sizeof(JournalEntry);
+}
+
+
+template <class Node>
+size_t OverlayContextTree<Node>::size(const arena_index_t index) const {
+	size_t nodes = 0;
+	std::vector<arena_index_t> stack(1, index);
+	while (!stack.empty()) {
+		const Node &n = node(stack.back());
+		stack.pop_back();
+		nodes++;
+		for (int c = 0; c < 2 && n.linksChildren(); c++) {
+			if (n.child(c)) stack.push_back(n.child(c));
+		}
+	}
+	return nodes;
+}
+
+
+// Walk the context path from the root, bringing each node into the overlay.
+// A node already in the overlay is journaled before the link to its child is
+// changed; a node copied or created here is journaled as allocated. A chain
+// is expanded in its overlay copy, so the rest of it is always allocated in
+// the overlay.
+template <class Node>
+void OverlayContextTree<Node>::copyContext(const bool lazy) {
+	assert(m_history.size() >= m_context_span);
+	m_journal_marks.push_back(m_journal.size());
+
+	arena_index_t *link = &m_root;
+	m_leaf = m_depth;
+	for (int i = 0; i <= m_depth; i++) {
+		if (i > 0 && m_context[i - 1]->isPruned()) {
+			m_leaf = i - 1;
+			break;
+		}
+		if (i > 0 && m_context[i - 1]->isChain()) {
+			Node &chain = *m_context[i - 1];
+			if (chain.chainAgreement(m_history, i - 1, m_depth) ==
+					m_depth - i + 1) {
+				m_leaf = i - 1;
+				break;
+			}
+			arena_index_t rest = m_nodes.allocate();
+			chain.expandChain(m_nodes[rest], rest | cOverlayBit, i - 1,
+				m_depth);
+			JournalEntry entry = { rest, true, m_nodes[rest] };
+			m_journal.push_back(entry);
+		}
+		if (i > 0) {
+			const symbol_t symbol = m_history.contextSymbol(i - 1);
+			link = &m_context[i - 1]->m_child[symbol];
+		}
+
+		arena_index_t index = *link;
+		if (index & cOverlayBit) {
+			index &= ~cOverlayBit;
+			JournalEntry entry = { index, false, m_nodes[index] };
+			m_journal.push_back(entry);
+		} else {
+			arena_index_t copy = m_nodes.allocate();
+			if (index != null_index) {
+				m_nodes[copy] = m_base.m_nodes[index];
+			} else if (lazy && i < m_depth &&
+					m_depth - i <= Node::cChainLevels) {
+				m_nodes[copy].makeChain(m_history, i, m_depth);
+				m_leaf = i;
+			}
+			JournalEntry entry = { copy, true, m_nodes[copy] };
+			m_journal.push_back(entry);
+			*link = copy | cOverlayBit;
+			index = copy;
+		}
+		m_context[i] = &m_nodes[index];
+		if (m_leaf == i) break;
+	}
+}
+
+
+// Mirrors Node::update() along the path. The children of overlay nodes may be
+// in either tree, so the new probabilities are computed here and committed
+// to the nodes.
+template <class Node>
+void OverlayContextTree<Node>::updatePath(const symbol_t symbol) {
+	double log_probability = 0.0;
+	for (int i = m_leaf; i >= 0; i--) {
+		Node &n = *m_context[i];
+		double log_kt = n.logKTAfter(symbol);
+		if (i == m_leaf) {
+			log_probability = log_kt;
+		} else {
+			const symbol_t context = m_history.contextSymbol(i);
+			arena_index_t sibling = n.child(!context);
+			double log_child_prob = log_probability +
+				(sibling ? node(sibling).logProbability() : 0.0);
+			log_probability = logMixture(log_kt, log_child_prob);
+		}
+		n.update(symbol, log_kt, log_probability);
+	}
+}
+
+
+// See ArenaContextTree::logProbabilityAfter().
+template <class Node>
+double OverlayContextTree<Node>::logProbabilityAfter(const arena_index_t index,
+		const int level, const symbol_t symbol) const {
+	if (index == null_index) return m_base.m_log_empty_after[level];
+	const Node &n = node(index);
+
+	double log_kt = n.logKTAfter(symbol);
+	if (level == m_depth || n.isPruned()) {
+		return log_kt;
+	}
+	if (n.isChain()) {
+		return ArenaContextTree<Node>::chainProbabilityAfter(n,
+			n.chainAgreement(m_history, level, m_depth), m_depth - level,
+			symbol);
+	}
+
+	const symbol_t context = m_history.contextSymbol(level);
+	double log_child_prob = logProbabilityAfter(n.child(context),
+		level + 1, symbol);
+	arena_index_t sibling = n.child(!context);
+	log_child_prob += sibling ? node(sibling).logProbability() : 0.0;
+	return logMixture(log_kt, log_child_prob);
+}
+
+
+
+// The node representations selectable through ContextTree::create().
+template class ArenaContextTree<CTNode>;
+template class ArenaContextTree<CompactCTNode>;
+template class ArenaContextTree<CountOnlyCTNode>;
+template class ArenaContextTree<CompactFloatCTNode>;
+template class ArenaContextTree<CompactFixedCTNode>;
+template class OverlayContextTree<CTNode>;
+template class OverlayContextTree<CompactCTNode>;
+template class OverlayContextTree<CountOnlyCTNode>;
+template class OverlayContextTree<CompactFloatCTNode>;
+template class OverlayContextTree<CompactFixedCTNode>;
+
+
+
+// The depth of a factored tree is the largest of the depths of its trees.
+static int maxDepth(const std::vector<ContextTree *> &trees) {
+	assert(!trees.empty());
+	size_t depth = 0;
+	for (size_t i = 0; i < trees.size(); i++) {
+		depth = std::max(depth, trees[i]->depth());
+	}
+	return int(depth);
+}
+
+
+HashedContextTree::HashedContextTree(const int depth, const size_t revert_bits,
+		const bool journal, const size_t entries) :
+	ContextTree(depth, revert_bits), m_replaced(false), m_leaf(-1),
+	m_journal_capacity(journal ? revert_bits : 0), m_journal_size(0),
+	m_journal_next(0)
+{
+	assert(depth <= 0xFF);
+	size_t size = cWindow;
+	while (size <= entries / 2) size *= 2;
+	m_keys.resize(size);
+	m_table.resize(size);
+	m_mask = size - 1;
+
+	m_path.resize(m_depth + 1);
+	m_hash.resize(m_depth + 1);
+	m_sibling.resize(m_depth + 1);
+	m_sibling_hash.resize(m_depth + 1);
+	m_log_kt_after.resize(m_depth + 1);
+	m_log_probability_after.resize(m_depth + 1);
+	m_saved.resize(m_depth + 1);
+	m_saved_keys.resize(m_depth + 1);
+	m_journal_entries.resize(m_journal_capacity * (m_depth + 1));
+	m_journal_keys.resize(m_journal_capacity * (m_depth + 1));
+	m_journal_path.resize(m_journal_capacity * (m_depth + 1));
+	m_journal_leaf.resize(m_journal_capacity);
+}
+
+
+// Clear tree and history. The table keeps its memory.
+void HashedContextTree::clear(void) {
+	m_history.clear();
+	std::fill(m_keys.begin(), m_keys.end(), 0);
+	std::fill(m_table.begin(), m_table.end(), Entry());
+	m_counts.clear();
+	m_replaced = false;
+	m_journal_size = 0;
+}
+
+
+// Update the tree with a single new symbol.
+void HashedContextTree::update(const symbol_t symbol) {
+
+	if (m_history.size() >= m_context_span) {
+		findContext(true);
+		journal();
+		updatePath(symbol);
+	}
+
+	updateHistory(symbol);
+}
+
+
+// Revert the most recent update.
+void HashedContextTree::revert(void) {
+	if (m_history.size() == 0)
+		return;
+
+	const symbol_t symbol = m_history.back();
+	m_history.pop_back();
+
+	// Restore the path from the journal if the update was recorded.
+	// Otherwise undo the update of each entry still in the table, from leaf
+	// to root, and remove those no longer visited. An entry which has not
+	// seen the symbol was created after the update was replaced, and is only
+	// recalculated.
+	if (m_history.size() >= m_context_span) {
+		if (m_journal_size > 0) {
+			restore();
+			return;
+		}
+		findContext(false);
+		for (int i = m_leaf; i >= 0; i--) {
+			Entry &entry = m_table[m_path[i]];
+			if (entry.count[symbol] > 0) {
+				entry.count[symbol]--;
+				entry.log_kt -= logPlusHalf(entry.count[symbol]) -
+					logPlusOne(entry.count[0] + entry.count[1]);
+			}
+			if (entry.count[0] + entry.count[1] == 0) {
+				entry = Entry();
+				m_keys[m_path[i]] = 0;
+				m_counts.released(i);
+				m_leaf = i - 1;
+			} else {
+				double log_path_prob = i < m_leaf ?
+					m_table[m_path[i + 1]].log_probability : 0.0;
+				entry.log_probability = logProbability(i, entry.log_kt,
+					log_path_prob);
+			}
+		}
+	}
+}
+
+
+// Sample a symbol and update the tree with it in a single walk of the path.
+symbol_t HashedContextTree::genRandomSymbolAndUpdate(void) {
+
+	// With insufficient context the prediction is 1/2 and the tree is not
+	// updated.
+	if (m_history.size() < m_context_span) {
+		const symbol_t symbol = rand01() < 0.5;
+		updateHistory(symbol);
+		return symbol;
+	}
+
+	// Compute the state of each node on the path after a one, from leaf to
+	// root. Nodes inserted for the path are empty, as logProbabilityAfter()
+	// assumes of missing ones.
+	findContext(true);
+	double log_before = 0.0;
+	for (int i = m_leaf; i >= 0; i--) {
+		const Entry &entry = m_table[m_path[i]];
+		m_log_kt_after[i] = entry.log_kt + logPlusHalf(entry.count[1]) -
+			logPlusOne(entry.count[0] + entry.count[1]);
+		m_log_probability_after[i] = logProbability(i, m_log_kt_after[i],
+			i < m_leaf ? m_log_probability_after[i + 1] : 0.0);
+		if (m_replaced) {
+			log_before = logProbability(i, entry.log_kt, log_before);
+		}
+	}
+	if (!m_replaced) {
+		log_before = m_table[m_path[0]].log_probability;
+	}
+
+	// Sample, then commit the precomputed state for a one or update the path
+	// for a zero.
+	weight_t prob_one = std::exp(m_log_probability_after[0] - log_before);
+	const symbol_t symbol = rand01() < prob_one;
+	journal();
+	if (symbol) {
+		for (int i = m_leaf; i >= 0; i--) {
+			Entry &entry = m_table[m_path[i]];
+			entry.log_kt = m_log_kt_after[i];
+			entry.log_probability = m_log_probability_after[i];
+			entry.count[1]++;
+			m_keys[m_path[i]] &= ~cPinBit;
+		}
+	} else {
+		updatePath(symbol);
+	}
+
+	updateHistory(symbol);
+	return symbol;
+}
+
+
+// The root's weighted probability, or that of an empty tree.
+double HashedContextTree::logBlockProbability(void) const {
+	size_t root = find(cRootHash, 0);
+	return root == cNoSlot ? 0.0 : m_table[root].log_probability;
+}
+
+
+// The log block probability after a hypothetical update with symbol.
+double HashedContextTree::logBlockProbabilityAfter(
+		const symbol_t symbol) const {
+	assert(m_history.size() >= m_context_span);
+	if (!m_replaced) {
+		return logProbabilityAfter(cRootHash, 0, symbol, NULL);
+	}
+	double log_before;
+	double log_after = logProbabilityAfter(cRootHash, 0, symbol, &log_before);
+	return logBlockProbability() + log_after - log_before;
+}
+
+
+// The table and the journal.
+size_t HashedContextTree::memoryUsage(void) const {
+	size_t journal = m_journal_capacity * (m_depth + 1) *
+		(entryBytes() + sizeof(size_t));
+	return m_table.size() * entryBytes() + journal;
+}
+
+
+// A 64-bit finalizer (from SplitMix64) applied to the parent's hash combined
+// with the symbol, so that every bit of the result depends on the whole
+// context.
+uint64_t HashedContextTree::childHash(const uint64_t hash,
+		const symbol_t symbol) {
+	uint64_t h = hash ^ (symbol ? 0x9E3779B97F4A7C15ull : 0xC2B2AE3D27D4EB4Full);
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+	return h ^ (h >> 31);
+}
+
+
+// Search the whole window: removed entries leave gaps, so an empty slot does
+// not end the search.
+size_t HashedContextTree::find(const uint64_t hash, const int level) const {
+	const uint64_t k = key(hash, level);
+	const size_t window = size_t(hash) & m_mask & ~(cWindow - 1);
+	for (size_t slot = window; slot < window + cWindow; slot++) {
+		if ((m_keys[slot] & ~cPinBit) == k) return slot;
+	}
+	return cNoSlot;
+}
+
+
+// Claim an empty slot if there is one in the window, otherwise the unpinned
+// entry with the fewest visits, preferring the deepest among equals.
+size_t HashedContextTree::insert(const uint64_t hash, const int level) {
+	const uint64_t k = key(hash, level);
+	const size_t window = size_t(hash) & m_mask & ~(cWindow - 1);
+	size_t victim = cNoSlot;
+	int victim_visits = 0, victim_level = 0;
+	for (size_t slot = window; slot < window + cWindow; slot++) {
+		const uint64_t slot_key = m_keys[slot];
+		if ((slot_key & ~cPinBit) == k) {
+			m_saved[level] = m_table[slot];
+			m_saved_keys[level] = slot_key;
+			return slot;
+		}
+		if (slot_key & cPinBit) continue;
+		int visits = slot_key ?
+			m_table[slot].count[0] + m_table[slot].count[1] : -1;
+		int entry_level = keyLevel(slot_key);
+		if (victim == cNoSlot || visits < victim_visits ||
+				(visits == victim_visits && entry_level > victim_level)) {
+			victim = slot;
+			victim_visits = visits;
+			victim_level = entry_level;
+		}
+	}
+	if (victim == cNoSlot) return cNoSlot;
+
+	m_saved[level] = m_table[victim];
+	m_saved_keys[level] = m_keys[victim];
+	if (m_keys[victim] != 0) {
+		m_counts.released(keyLevel(m_keys[victim]));
+		m_replaced = true;
+	}
+	m_counts.created(level);
+	m_table[victim] = Entry();
+	m_keys[victim] = k;
+	return victim;
+}
+
+
+// Hash the context from root to leaf, one more symbol of it at each level,
+// then walk it. The context is read from the history 64 symbols at a time,
+// most recent first. The hashes do not depend on the table, so the windows of
+// the whole path and of the siblings are prefetched before the walk, and
+// their cache misses overlap instead of being taken one level at a time.
+void HashedContextTree::findContext(const bool create) {
+	assert(m_history.size() >= m_context_span);
+
+	m_hash[0] = cRootHash;
+	prefetch(cRootHash);
+	uint64_t context = 0;
+	for (int i = 1; i <= m_depth; i++, context >>= 1) {
+		if ((i - 1) % 64 == 0) context = m_history.context(i - 1);
+		const symbol_t symbol = (context & 1) != 0;
+		m_hash[i] = childHash(m_hash[i - 1], symbol);
+		m_sibling_hash[i - 1] = childHash(m_hash[i - 1], !symbol);
+		prefetch(m_hash[i]);
+		prefetch(m_sibling_hash[i - 1]);
+	}
+
+	m_leaf = m_depth;
+	for (int i = 0; i <= m_depth; i++) {
+		size_t slot = create ? insert(m_hash[i], i) : find(m_hash[i], i);
+		if (slot == cNoSlot) {
+			m_leaf = i - 1;
+			break;
+		}
+		m_path[i] = slot;
+		if (create) m_keys[slot] |= cPinBit;
+	}
+
+	// Look up the siblings once the path is complete, as inserting it may
+	// replace them.
+	for (int i = 0; i <= m_leaf; i++) {
+		m_sibling[i] = i < m_depth ? find(m_sibling_hash[i], i + 1) : cNoSlot;
+	}
+}
+
+
+// Bring the keys of a window into the cache, and the start of its entries.
+void HashedContextTree::prefetch(const uint64_t hash) const {
+#ifdef __GNUC__
+	const size_t window = size_t(hash) & m_mask & ~(cWindow - 1);
+	__builtin_prefetch(&m_keys[window]);
+	__builtin_prefetch(&m_keys[window + cWindow - 1]);
+	__builtin_prefetch(&m_table[window]);
+#endif
+}
+
+
+// As CTNode::updateLogProbability(), where a node is a leaf if it is at the
+// maximum depth or has no child in the table.
+double HashedContextTree::logProbability(const int level,
+		const double log_kt, const double log_path_prob) const {
+	size_t other = m_sibling[level];
+	if (level == m_leaf && other == cNoSlot) {
+		return log_kt;
+	}
+	double log_child_prob = log_path_prob;
+	if (other != cNoSlot) {
+		log_child_prob += m_table[other].log_probability;
+	}
+	return logMixture(log_kt, log_child_prob);
+}
+
+
+// See ArenaContextTree::update().
+void HashedContextTree::updatePath(const symbol_t symbol) {
+	for (int i = m_leaf; i >= 0; i--) {
+		// Pinning keeps each node of the path in a slot of its own.
+		assert(keyLevel(m_keys[m_path[i]]) == i &&
+			(m_keys[m_path[i]] & cPinBit) != 0);
+		Entry &entry = m_table[m_path[i]];
+		entry.log_kt += logPlusHalf(entry.count[symbol]) -
+			logPlusOne(entry.count[0] + entry.count[1]);
+		double log_path_prob = i < m_leaf ?
+			m_table[m_path[i + 1]].log_probability : 0.0;
+		entry.log_probability = logProbability(i, entry.log_kt,
+			log_path_prob);
+		entry.count[symbol]++;
+		m_keys[m_path[i]] &= ~cPinBit;
+	}
+}
+
+
+// As ArenaContextTree::logProbabilityAfter(), with a node missing from the
+// table evaluated as an empty one.
+double HashedContextTree::logProbabilityAfter(const uint64_t hash,
+		const int level, const symbol_t symbol, double *log_before) const {
+	static const Entry empty = Entry();
+	size_t slot = find(hash, level);
+	const Entry &entry = slot == cNoSlot ? empty : m_table[slot];
+
+	double log_kt = entry.log_kt + logPlusHalf(entry.count[symbol]) -
+		logPlusOne(entry.count[0] + entry.count[1]);
+	if (level == m_depth) {
+		if (log_before) *log_before = entry.log_kt;
+		return log_kt;
+	}
+
+	// The child on the context path is updated; its sibling is unchanged.
+	const symbol_t context = m_history.contextSymbol(level);
+	double log_child_prob = logProbabilityAfter(childHash(hash, context),
+		level + 1, symbol, log_before);
+	size_t other = find(childHash(hash, !context), level + 1);
+	double log_other_prob = other != cNoSlot ?
+		m_table[other].log_probability : 0.0;
+	if (log_before) {
+		*log_before = logMixture(entry.log_kt, *log_before + log_other_prob);
+	}
+	return logMixture(log_kt, log_child_prob + log_other_prob);
+}
+
+
+// Record the previous contents of the slots on the path.
+void HashedContextTree::journal(void) {
+	if (m_journal_capacity == 0) return;
+
+	size_t base = m_journal_next * (m_depth + 1);
+	for (int i = 0; i <= m_leaf; i++) {
+		m_journal_entries[base + i] = m_saved[i];
+		m_journal_keys[base + i] = m_saved_keys[i];
+		m_journal_path[base + i] = m_path[i];
+	}
+	m_journal_leaf[m_journal_next] = m_leaf;
+
+	m_journal_next = (m_journal_next + 1) % m_journal_capacity;
+	m_journal_size = std::min(m_journal_size + 1, m_journal_capacity);
+}
+
+
+// Undo the most recent journaled update by copying back the saved slots,
+// which also brings back any entries it replaced.
+void HashedContextTree::restore(void) {
+	assert(m_journal_size > 0);
+	m_journal_next = (m_journal_next + m_journal_capacity - 1) %
+		m_journal_capacity;
+	m_journal_size--;
+
+	size_t base = m_journal_next * (m_depth + 1);
+	for (int i = m_journal_leaf[m_journal_next]; i >= 0; i--) {
+		const size_t slot = m_journal_path[base + i];
+		const uint64_t saved_key = m_journal_keys[base + i];
+		if ((saved_key & ~cPinBit) != (m_keys[slot] & ~cPinBit)) {
+			m_counts.released(i);
+			if (saved_key) m_counts.created(keyLevel(saved_key));
+		}
+		m_keys[slot] = saved_key;
+		m_table[slot] = m_journal_entries[base + i];
+	}
+}
+
+
+FactoredContextTree::FactoredContextTree(
+		const std::vector<ContextTree *> &trees, const size_t revert_bits,
+		const int threads) :
+	ContextTree(maxDepth(trees), revert_bits), m_trees(trees),
+	m_position(0), m_percept(NULL), m_pool(NULL)
+{
+	if (threads > 1) {
+		m_pool = new ThreadPool(std::min(threads, int(m_trees.size())));
+	}
+}
+
+
+// Destroy the trees and stop the workers.
+FactoredContextTree::~FactoredContextTree(void) {
+	delete m_pool;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		delete m_trees[i];
+	}
+}
+
+
+// Clear every tree and the history.
+void FactoredContextTree::clear(void) {
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		m_trees[i]->clear();
+	}
+	m_history.clear();
+	m_position = 0;
+}
+
+
+// Update the tree for the current percept bit; the others only see the
+// symbol as context.
+void FactoredContextTree::update(const symbol_t symbol) {
+	for (int i = 0; i < int(m_trees.size()); i++) {
+		if (i == m_position) {
+			m_trees[i]->update(symbol);
+		} else {
+			m_trees[i]->updateHistory(symbol);
+		}
+	}
+	m_history.push_back(symbol);
+	m_position = (m_position + 1) % int(m_trees.size());
+}
+
+
+// Update every tree with a whole percept at once, in parallel if possible.
+void FactoredContextTree::update(symbol_list_t const& symbols) {
+	if (m_position != 0 || symbols.size() != m_trees.size()) {
+		ContextTree::update(symbols);
+		return;
+	}
+
+	m_percept = &symbols;
+	runTasks(updateTask);
+	m_percept = NULL;
+	for (size_t i = 0; i < symbols.size(); i++) {
+		m_history.push_back(symbols[i]);
+	}
+}
+
+
+// Append an action symbol to the history of every tree.
+void FactoredContextTree::updateHistory(const symbol_t symbol) {
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		m_trees[i]->updateHistory(symbol);
+	}
+	m_history.push_back(symbol);
+}
+
+
+// Append action symbols to the history of every tree.
+void FactoredContextTree::updateHistory(symbol_list_t const& symbols) {
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		m_trees[i]->updateHistory(symbols);
+	}
+	for (size_t i = 0; i < symbols.size(); i++) {
+		m_history.push_back(symbols[i]);
+	}
+}
+
+
+// Revert the most recent percept bit.
+void FactoredContextTree::revert(void) {
+	if (m_history.size() == 0)
+		return;
+
+	m_position = (m_position + int(m_trees.size()) - 1) % int(m_trees.size());
+	for (int i = 0; i < int(m_trees.size()); i++) {
+		if (i == m_position) {
+			m_trees[i]->revert();
+		} else {
+			m_trees[i]->revertHistory(1);
+		}
+	}
+	m_history.pop_back();
+}
+
+
+// Revert a whole percept at once, in parallel if possible.
+void FactoredContextTree::revert(const int num_symbols) {
+	if (m_position != 0 || num_symbols != int(m_trees.size())) {
+		ContextTree::revert(num_symbols);
+		return;
+	}
+
+	runTasks(revertTask);
+	m_history.resize(m_history.size() - num_symbols);
+}
+
+
+// Remove action symbols from the history of every tree.
+void FactoredContextTree::revertHistory(const int num_symbols) {
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		m_trees[i]->revertHistory(num_symbols);
+	}
+	ContextTree::revertHistory(num_symbols);
+}
+
+
+// Sample the next percept bit from its tree.
+symbol_t FactoredContextTree::genRandomSymbolAndUpdate(void) {
+	const symbol_t symbol = m_trees[m_position]->genRandomSymbolAndUpdate();
+	for (int i = 0; i < int(m_trees.size()); i++) {
+		if (i != m_position) {
+			m_trees[i]->updateHistory(symbol);
+		}
+	}
+	m_history.push_back(symbol);
+	m_position = (m_position + 1) % int(m_trees.size());
+	return symbol;
+}
+
+
+// The block probability of the percepts is the product of the block
+// probabilities of the percept bits.
+double FactoredContextTree::logBlockProbability(void) const {
+	double log_prob = 0.0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		log_prob += m_trees[i]->logBlockProbability();
+	}
+	return log_prob;
+}
+
+
+// Only the tree for the next percept bit changes.
+double FactoredContextTree::logBlockProbabilityAfter(
+		const symbol_t symbol) const {
+	const ContextTree *tree = m_trees[m_position];
+	return logBlockProbability() - tree->logBlockProbability() +
+		tree->logBlockProbabilityAfter(symbol);
+}
+
+
+// The total number of nodes in the trees.
+size_t FactoredContextTree::size(void) const {
+	size_t nodes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		nodes += m_trees[i]->size();
+	}
+	return nodes;
+}
+
+
+// Trees shallower than the level have no nodes there.
+size_t FactoredContextTree::levelSize(const int level) const {
+	size_t nodes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		if (level <= int(m_trees[i]->depth()))
+			nodes += m_trees[i]->levelSize(level);
+	}
+	return nodes;
+}
+
+
+size_t FactoredContextTree::nodesCreated(void) const {
+	size_t nodes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		nodes += m_trees[i]->nodesCreated();
+	}
+	return nodes;
+}
+
+
+size_t FactoredContextTree::nodesReleased(void) const {
+	size_t nodes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		nodes += m_trees[i]->nodesReleased();
+	}
+	return nodes;
+}
+
+
+// Prune each tree separately.
+size_t FactoredContextTree::prune(void) {
+	size_t released = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		released += m_trees[i]->prune();
+	}
+	return released;
+}
+
+
+// The factored tree's own history only decides when the trees are ready to
+// predict.
+void FactoredContextTree::selectContext(const std::vector<size_t> &ages) {
+	ContextTree::selectContext(ages);
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		m_trees[i]->selectContext(ages);
+	}
+}
+
+
+// Compact each tree separately.
+bool FactoredContextTree::compact(void) {
+	bool moved = false;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		if (m_trees[i]->compact()) moved = true;
+	}
+	return moved;
+}
+
+
+// Every tree is walked once per percept, so the trees count equally.
+double FactoredContextTree::pathCost(void) const {
+	double cost = 0.0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		cost += m_trees[i]->pathCost();
+	}
+	return cost / double(m_trees.size());
+}
+
+
+// The total memory held by the trees.
+size_t FactoredContextTree::memoryUsage(void) const {
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		bytes += m_trees[i]->memoryUsage();
+	}
+	return bytes;
+}
+
+
+size_t FactoredContextTree::nodeBytes(void) const {
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_trees.size(); i++) {
+		bytes += m_trees[i]->nodeBytes();
+	}
+	return bytes;
+}
+
+
+// Tree i is updated with bit i of the percept, and sees the bits before and
+// after it as history.
+void FactoredContextTree::updateTask(void *context, const int i) {
+	FactoredContextTree *ct = static_cast<FactoredContextTree *>(context);
+	const symbol_list_t &percept = *ct->m_percept;
+	ContextTree *tree = ct->m_trees[i];
+	for (int j = 0; j < int(percept.size()); j++) {
+		if (j == i) {
+			tree->update(percept[j]);
+		} else {
+			tree->updateHistory(percept[j]);
+		}
+	}
+}
+
+
+// Undo updateTask().
+void FactoredContextTree::revertTask(void *context, const int i) {
+	FactoredContextTree *ct = static_cast<FactoredContextTree *>(context);
+	ContextTree *tree = ct->m_trees[i];
+	int bits = int(ct->m_trees.size());
+	tree->revertHistory(bits - 1 - i);
+	tree->revert();
+	tree->revertHistory(i);
+}
+
+
+// Run a task for each tree.
+void FactoredContextTree::runTasks(void (*task)(void *, const int)) {
+	if (m_pool) {
+		m_pool->run(task, this, int(m_trees.size()));
+	} else {
+		for (int i = 0; i < int(m_trees.size()); i++) {
+			task(this, i);
+		}
 	}
 }
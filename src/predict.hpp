@@ -1,6 +1,12 @@
 #ifndef __PREDICT_HPP__
 #define __PREDICT_HPP__
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <type_traits>
 #include <vector>
+#include "arena.hpp"
+#include "history.hpp"
 #include "main.hpp"
 
 /** Stores symbol occurrence counts. */
@@ -9,6 +15,57 @@ typedef int count_t;
 /** Holds context weights. */
 typedef double weight_t;
 
+template <class Node> class ArenaContextTree;
+template <class Node> class OverlayContextTree;
+class ModelFile;
+class ThreadPool;
+
+/** Stored in both child links of a node whose subtree has been pruned (see
+ * ArenaContextTree::prune()). Such a node is a leaf of the tree, however
+ * shallow, and is never given children again. */
+static const arena_index_t pruned_index = 0xFFFFFFFFu;
+
+/** Stored in the first child link of a chain node, which stands for the path
+ * of single-child nodes from it down to the maximum depth of the tree (see
+ * ArenaContextTree::updateContext()). The context of the path is stored in
+ * place of the node's second child link and weighted probability. */
+static const arena_index_t chain_index = 0xFFFFFFFEu;
+
+/** The greatest number of levels below a chain node. A node format whose
+ * weighted probability takes 4 bytes has room for fewer (see
+ * CountingCTNode::cChainLevels). */
+static const int chain_levels = 96;
+
+/** A log probability stored in 32-bit fixed point, in units of
+ * 2^-FixedLogWeight::cFractionBits nats, for ::CompactFixedCTNode. It
+ * converts to and from double, and values are rounded to the nearest unit
+ * when stored. Its range of about two million nats covers the weighted
+ * probability of a context seen for several million symbols; values beyond
+ * it saturate. */
+class FixedLogWeight {
+public:
+	/** \return The value in nats. */
+	operator double(void) const { return double(m_value) * (1.0 / cUnits); }
+
+	/** Store a value in nats, rounded to the nearest unit. Scaling by a
+	 * power of two is exact. */
+	FixedLogWeight &operator=(const double value) {
+		double units = value * cUnits;
+		units = std::max(std::min(units, 2147483647.0), -2147483647.0);
+		m_value = int32_t(units < 0.0 ? units - 0.5 : units + 0.5);
+		return *this;
+	}
+
+	/** The number of bits of the value below the binary point. */
+	static const int cFractionBits = 10;
+
+private:
+	/** The number of units in a nat. */
+	static const int cUnits = 1 << cFractionBits;
+
+	int32_t m_value;
+};
+
 /** The ::CTNode class represents a node in an action-conditional context tree. The
  * purpose of each node is to calculate the weighted probability of observing
  * a particular bit sequence. In particular, denote by \f$ n \f$ the
@@ -52,14 +109,16 @@ typedef double weight_t;
  *    CTNode::updateLogProbability().
  *
  * In order to calculate these probabilities, ::CTNode also stores:
- *  - Links to child nodes: CTNode::child(), CTNode::m_child.
+ *  - Links to child nodes: CTNode::child(), CTNode::m_child. Nodes live in an
+ *    ::Arena owned by the ::ContextTree and children are referred to by their
+ *    32-bit arena index rather than by pointer.
  *  - The number of zeros and ones in the history subsequence relevant to the
  *    node: CTNode::m_count.
  *
  *
  * The ::CTNode class is tightly coupled with the ::ContextTree class. Briefly,
  * the ::ContextTree class
- *  - Creates and deletes nodes.
+ *  - Creates and releases nodes in its node arena.
  *  - Tells the appropriate nodes to update/revert their probability estimates.
  *  - Samples actions and percepts from the probability distribution specified
  *    by the nodes. */
@@ -72,7 +131,11 @@ class CTNode {
 	 *    simply return these calculated values.
 	 *  - This arrangement allows the ::ContextTree class to create/delete
 	 *    nodes from the context tree. */
-	friend class ContextTree;
+	template <class Node> friend class ArenaContextTree;
+	template <class Node> friend class OverlayContextTree;
+
+	/** The node arena default-constructs nodes in place. */
+	friend class Arena<CTNode>;
 
 public:
 
@@ -91,25 +154,47 @@ public:
 	/** Retrieves the cached weighted log probability of the history subsequence
 	 * relevant to this node. The value is computed only when the node is
 	 * changed (by CTNode::update() or CTNode::revert()) and is cached in the
-	 * variable CTNode::m_log_probability.
+	 * variable CTNode::m_log_probability. A chain node is not a mixture: every
+	 * node of the path it stands for has the same counts, so each weighted
+	 * probability is the KT estimate.
 	 *
 	 * \return The log weighted probability \f$ \ln P_w^n \f$. */
-	weight_t logProbability(void) const { return m_log_probability; }
+	weight_t logProbability(void) const {
+		return isChain() ? m_log_kt : m_log_probability;
+	}
 
 
-	/** The child node corresponding to a particular symbol. */
-	const CTNode *child(const symbol_t sym) const {	return m_child[sym]; }
+	/** The arena index of the child node corresponding to a particular
+	 * symbol, or ::null_index if there is no such child. */
+	arena_index_t child(const symbol_t sym) const { return m_child[sym]; }
 
 
 	/** Checks if this is a leaf node.
 	 * \return True if the node is a leaf node, false otherwise. */
 	bool isLeafNode(void) const {
-		return (child(false) == NULL) && (child(true) == NULL);
+		return !linksChildren() ||
+			((child(false) == null_index) && (child(true) == null_index));
 	}
 
 
-	/** The number of nodes in the tree rooted at this node. */
-	int size(void) const;
+	/** Checks if the subtree below this node has been pruned, making it a
+	 * permanent leaf. The child links then hold ::pruned_index. */
+	bool isPruned(void) const { return m_child[0] == pruned_index; }
+
+
+	/** Checks if this node is a chain node (see ::chain_index), a leaf which
+	 * stands for a path of nodes down to the maximum depth. */
+	bool isChain(void) const { return m_child[0] == chain_index; }
+
+
+	/** Checks if the child links hold children, rather than marking the node
+	 * as pruned or as a chain. */
+	bool linksChildren(void) const { return m_child[0] < chain_index; }
+
+
+	/** The number of nodes in the tree rooted at this node.
+	 * \param nodes The arena holding this node's descendants. */
+	int size(const Arena<CTNode> &nodes) const;
 
 
 	/** The number of times this context has been visited. This is equivalent to
@@ -118,15 +203,35 @@ public:
 	int visits(void) const { return m_count[false] + m_count[true]; }
 
 
+	/** Precompute the logarithms \f$ \ln(k + 1/2) \f$ and \f$ \ln(k + 1) \f$
+	 * for \f$ 0 \le k < \f$ size, so that CTNode::logKTMultiplier() can look
+	 * them up rather than calling std::log, and likewise
+	 * \f$ \ln \Gamma(k + 1/2) \f$ and \f$ \ln \Gamma(k + 1) \f$ for
+	 * CountingCTNode::logKT(). Counts at or above the threshold still use
+	 * std::log and the log-gamma function. The tables are shared by every
+	 * context tree.
+	 * \param size The number of counts to tabulate. Zero disables the
+	 * tables. */
+	static void setLogTableSize(const int size);
+
+
+	/** Choose how the weighted probability of an internal node mixes the KT
+	 * estimate with the children's probability. This requires \f$ \ln(1 +
+	 * e^{-x}) \f$, which the exact path computes with std::log and std::exp.
+	 * When enabled, it is instead interpolated linearly from a table sampled
+	 * every 1/256 over \f$ 0 \le x < 40 \f$ (about 80KB). The setting is
+	 * shared by every context tree and both node formats.
+	 * \param enable True to use the table, false for the exact computation.
+	 * \return The largest absolute error of the interpolation, measured at
+	 * the midpoints between table entries (zero for the exact computation). */
+	static double setLogAddTable(const bool enable);
+
+
 private:
 	/** Initialise the node. */
 	CTNode(void);
 
 
-	/** Destroy the node and all children. */
-	~CTNode(void);
-
-
 	/** Compute the logarithm of the KT-estimator update multiplier. The
 	 * log KT estimate of the conditional probability of observing a zero given
 	 * we have observed \f$ a \f$ zeros and \f$ b \f$ ones at the current node is
@@ -143,11 +248,20 @@ private:
 	 * conditional probability. False corresponds to calculating \f$ \ln
 	 * \Pr_\text{kt}(0 \,|\, 0^a1^b) \f$ and true corresponds to calculating
 	 * \f$ \ln \Pr_\text{kt}(1 \,|\, 0^a1^b) \f$.
+	 * The logarithm is computed as \f$ \ln(a + 1/2) - \ln(a + b + 1) \f$,
+	 * taking both terms from the tables built by CTNode::setLogTableSize()
+	 * when the counts are small enough.
+	 *
 	 * \return The log KT estimate of the conditional probability (update
 	 * multiplier). */
 	weight_t logKTMultiplier(const symbol_t symbol) const;
 
 
+	/** \return The log KT estimate the node would have after observing a
+	 * symbol. Used to make predictions without updating the node. */
+	weight_t logKTAfter(const symbol_t symbol) const;
+
+
 	/** Calculates the logarithm of the weighted block probability
 	 * \f[
 	 *     \ln P^n_w :=
@@ -184,29 +298,89 @@ private:
 	 * \f]
 	 * In order to avoid overflow problems, we choose the formulation for which
 	 * the argument of the exponent \f$ \exp(\ln b - \ln a) \f$ is as small as
-	 * possible. */
-	void updateLogProbability(void);
+	 * possible.
+	 *
+	 * \param nodes The arena holding the children of this node. */
+	void updateLogProbability(const Arena<CTNode> &nodes);
 
 
 	/** Update the node after having observed a new symbol. This involves
 	 * updating the symbol counts and recalculating the cached probabilities.
-	 * \param The symbol that was observed. */
-	void update(const symbol_t symbol);
+	 * \param The symbol that was observed.
+	 * \param nodes The arena holding the children of this node. */
+	void update(const symbol_t symbol, const Arena<CTNode> &nodes);
+
+
+	/** Update the node with results computed in advance, e.g. while making a
+	 * prediction. Equivalent to CTNode::update() when the arguments are the
+	 * values it would compute.
+	 * \param symbol The symbol that was observed.
+	 * \param log_kt The KT estimate from CTNode::logKTAfter().
+	 * \param log_probability The new weighted probability. */
+	void update(const symbol_t symbol, const weight_t log_kt,
+		const weight_t log_probability);
 
 
 	/** Return the node to its state immediately prior to the last update. This
 	 * involves updating the symbol counts, recalculating the cached
-	 * probabilities, and deleting unnecessary child nodes.
-	 * \param symbol The symbol used in the previous update. */
-	void revert(const symbol_t symbol);
+	 * probabilities, and releasing child nodes which are no longer visited.
+	 * \param symbol The symbol used in the previous update.
+	 * \param nodes The arena holding the children of this node.
+	 * \return The number of children released. */
+	int revert(const symbol_t symbol, Arena<CTNode> &nodes);
+
+
+	/** Turn a new node into a chain node following the current context.
+	 * \param history The history giving the context.
+	 * \param level The depth of the node.
+	 * \param depth The maximum depth of the tree, at most ::chain_levels
+	 * below the node. */
+	void makeChain(const History &history, const int level, const int depth);
+
+
+	/** \return The number of levels below this chain node whose context
+	 * agrees with the current context, counted from the top; all of them
+	 * (depth - level) if the current context follows the chain. */
+	int chainAgreement(const History &history, const int level,
+		const int depth) const;
+
+
+	/** Split the top level off this chain node, leaving an ordinary node with
+	 * a single child which stands for the rest of the chain (or is a leaf at
+	 * the maximum depth). Both have this node's counts.
+	 * \param child A new node to become the child.
+	 * \param link The index to store in the child link.
+	 * \param level The depth of this node.
+	 * \param depth The maximum depth of the tree. */
+	void expandChain(CTNode &child, const arena_index_t link, const int level,
+		const int depth);
+
+
+	/** Undo CTNode::expandChain(): turn an ordinary node back into a chain
+	 * node if its only child stands for the rest of a chain (or is a leaf at
+	 * the maximum depth) and has the same counts. The child is not released.
+	 * \param child The child.
+	 * \param level The depth of this node.
+	 * \param depth The maximum depth of the tree.
+	 * \return True if this node became a chain node. */
+	bool mergeChain(const CTNode &child, const int level, const int depth);
+
+
+	/** The greatest number of levels below a chain node. */
+	static const int cChainLevels = chain_levels;
 
 
 	/** The cached KT estimate of the block log probability for this node. */
 	weight_t m_log_kt;
 
 
-	/** The cached weighted log probability for this node. */
-	weight_t m_log_probability;
+	/** The cached weighted log probability for this node. A chain node keeps
+	 * the first 64 symbols of its context here instead, and the remaining
+	 * ones in CTNode::m_child[1]. */
+	union {
+		weight_t m_log_probability;
+		uint64_t m_chain;
+	};
 
 
 	/** The number of zeros (CTNode::m_count[0]) and ones (CTNode::m_count[1])
@@ -214,20 +388,281 @@ private:
 	int m_count[2];
 
 
-	/** The children of this node. */
-	CTNode *m_child[2];
+	/** The arena indices of the children of this node. */
+	arena_index_t m_child[2];
+};
+
+
+
+/** An alternative to ::CTNode for very large context trees, which stores
+ * only the symbol counts, the weighted probability and the child links. It
+ * holds the same information and performs the same double precision
+ * computations, but stores it more tightly:
+ *  - The KT estimate is not cached. It is fully determined by the symbol
+ *    counts and is recomputed from them by CountingCTNode::logKT(), through
+ *    the tables of \f$ \ln \Gamma \f$ built by CTNode::setLogTableSize(). A
+ *    revert is a count decrement followed by the same recomputation, so the
+ *    estimate never drifts from its counts.
+ *  - The symbol counts have the type Count. When a count would overflow, both
+ *    counts are halved, which keeps their ratio (and so the KT prediction)
+ *    intact while gradually discounting old observations.
+ *  - The fields are packed to 4 byte alignment, so the node has no padding.
+ *
+ * There are two instances: ::CompactCTNode, with 16-bit counts in 20 bytes,
+ * and ::CountOnlyCTNode, with 32-bit counts which never halve in practice in
+ * 24 bytes.
+ *
+ * The weighted probability is stored as a Weight, which is double for both:
+ * it is the quantity whose differences at the root give every prediction,
+ * and its magnitude grows with the length of the history. The reduced
+ * precision instances ::CompactFloatCTNode and ::CompactFixedCTNode store it
+ * in 4 bytes, as a float or a ::FixedLogWeight, for 16 byte nodes. Only the
+ * storage is reduced: the weighted probability is still computed in double
+ * precision and rounded when stored, so these formats save memory but not
+ * time. Their predictions differ from those of ::CompactCTNode only by the
+ * rounding of the nodes on the path; the ct-precision-check option of the
+ * ::Agent measures the difference from both ::CompactCTNode and ::CTNode. A
+ * chain node keeps 64 bits of its context in the weighted probability and
+ * the second child link, so their chains cover at most 64 levels. The
+ * ::ContextTree reports the size of a node and the saving over ::CTNode when
+ * it is created (see ContextTree::create()). */
+#pragma pack(push, 4)
+template <class Count, class Weight>
+class CountingCTNode {
+	template <class Node> friend class ArenaContextTree;
+	template <class Node> friend class OverlayContextTree;
+
+	/** The node arena default-constructs nodes in place. */
+	friend class Arena<CountingCTNode>;
+
+public:
+
+	/** The KT estimate of the log probability of the history subsequence
+	 * relevant to this node, computed from the symbol counts. See
+	 * CTNode::logKT(). */
+	weight_t logKT(void) const;
+
+	/** The cached weighted log probability of the history subsequence relevant
+	 * to this node. See CTNode::logProbability(). */
+	weight_t logProbability(void) const {
+		return isChain() ? logKT() : weight_t(m_log_probability);
+	}
+
+	/** The arena index of the child node corresponding to a particular symbol,
+	 * or ::null_index if there is no such child. */
+	arena_index_t child(const symbol_t sym) const { return m_child[sym]; }
+
+	/** Checks if this is a leaf node. */
+	bool isLeafNode(void) const {
+		return !linksChildren() ||
+			((child(false) == null_index) && (child(true) == null_index));
+	}
+
+	/** Checks if the subtree below this node has been pruned. See
+	 * CTNode::isPruned(). */
+	bool isPruned(void) const { return m_child[0] == pruned_index; }
+
+	/** Checks if this is a chain node. See CTNode::isChain(). */
+	bool isChain(void) const { return m_child[0] == chain_index; }
+
+	/** Checks if the child links hold children. See
+	 * CTNode::linksChildren(). */
+	bool linksChildren(void) const { return m_child[0] < chain_index; }
+
+	/** The number of nodes in the tree rooted at this node. */
+	int size(const Arena<CountingCTNode> &nodes) const;
+
+	/** The number of times this context has been visited, up to the halving
+	 * of the counts. */
+	int visits(void) const { return int(m_count[false]) + int(m_count[true]); }
+
+private:
+
+	/** Initialise the node. */
+	CountingCTNode(void);
+
+	/** Recalculate the weighted log probability. See
+	 * CTNode::updateLogProbability(). */
+	void updateLogProbability(const Arena<CountingCTNode> &nodes);
+
+	/** \return The log KT estimate the node would have after observing a
+	 * symbol, including any halving of the counts. See CTNode::logKTAfter(). */
+	weight_t logKTAfter(const symbol_t symbol) const;
+
+	/** Update the node after having observed a new symbol. See
+	 * CTNode::update(). */
+	void update(const symbol_t symbol, const Arena<CountingCTNode> &nodes);
+
+	/** Update the node with results computed in advance. See
+	 * CTNode::update(symbol_t, weight_t, weight_t). The KT estimate is
+	 * derived from the counts and so is ignored. */
+	void update(const symbol_t symbol, const weight_t log_kt,
+		const weight_t log_probability);
+
+	/** Return the node to its state immediately prior to the last update. See
+	 * CTNode::revert(). An update which halved the counts cannot be undone
+	 * exactly; the halved counts are kept.
+	 * \return The number of children released. */
+	int revert(const symbol_t symbol, Arena<CountingCTNode> &nodes);
+
+	/** See CTNode::makeChain(). */
+	void makeChain(const History &history, const int level, const int depth);
+
+	/** See CTNode::chainAgreement(). */
+	int chainAgreement(const History &history, const int level,
+		const int depth) const;
+
+	/** See CTNode::expandChain(). */
+	void expandChain(CountingCTNode &child, const arena_index_t link,
+		const int level, const int depth);
+
+	/** See CTNode::mergeChain(). */
+	bool mergeChain(const CountingCTNode &child, const int level,
+		const int depth);
+
+	/** Halve both counts, rounding up so that seen symbols stay seen. */
+	void halveCounts(void);
+
+	/** The context of a chain node, the first 64 symbols in low and any
+	 * remaining ones in high. */
+	void chainContext(uint64_t &low, uint32_t &high) const;
+
+	/** Store the context of a chain node. See
+	 * CountingCTNode::chainContext(). */
+	void setChainContext(const uint64_t low, const uint32_t high);
+
+	/** The largest value of a symbol count. */
+	static const Count cMaxCount = Count(~Count(0));
+
+	/** The part of a chain node's context kept in place of the weighted
+	 * probability: as wide as the weighted probability. */
+	typedef typename std::conditional<sizeof(Weight) == 8, uint64_t,
+		uint32_t>::type chain_t;
+
+	/** The greatest number of levels below a chain node. */
+	static const int cChainLevels = int(8 * sizeof(chain_t)) + 32;
+
+	/** The cached weighted log probability for this node, or part of the
+	 * context of a chain node (see CountingCTNode::chainContext()). */
+	union {
+		Weight m_log_probability;
+		chain_t m_chain;
+	};
+
+	/** The arena indices of the children of this node. */
+	arena_index_t m_child[2];
+
+	/** The number of zeros and ones in the history subsequence relevant to
+	 * this node (see CountingCTNode::cMaxCount). */
+	Count m_count[2];
+};
+#pragma pack(pop)
+
+/** A 20 byte ::CountingCTNode with 16-bit counts. */
+typedef CountingCTNode<uint16_t, double> CompactCTNode;
+
+/** A 24 byte ::CountingCTNode with 32-bit counts: a ::CTNode without the
+ * cached KT estimate. */
+typedef CountingCTNode<uint32_t, double> CountOnlyCTNode;
+
+/** A 16 byte ::CountingCTNode with 16-bit counts and a single precision
+ * weighted probability. */
+typedef CountingCTNode<uint16_t, float> CompactFloatCTNode;
+
+/** A 16 byte ::CountingCTNode with 16-bit counts and a fixed point weighted
+ * probability. */
+typedef CountingCTNode<uint16_t, FixedLogWeight> CompactFixedCTNode;
+
+/** Fail to compile if a ::CountingCTNode picks up any padding. */
+typedef char compact_node_size_check[sizeof(CompactCTNode) == 20 ? 1 : -1];
+typedef char count_only_node_size_check[
+	sizeof(CountOnlyCTNode) == 24 ? 1 : -1];
+typedef char compact_float_node_size_check[
+	sizeof(CompactFloatCTNode) == 16 ? 1 : -1];
+typedef char compact_fixed_node_size_check[
+	sizeof(CompactFixedCTNode) == 16 ? 1 : -1];
+
+
+
+/** The number of nodes a context tree holds at each depth, kept up to date as
+ * nodes are created and released so that the size of the tree is known
+ * without walking it. The numbers of nodes created and released are running
+ * totals: the churn over a period is the difference between its ends. */
+class NodeCounts {
+public:
+
+	/** Start with no nodes.
+	 * \param depth The maximum depth of the tree. */
+	NodeCounts(const int depth) :
+		m_levels(depth + 1, 0), m_total(0), m_created(0), m_released(0) {}
+
+	/** Count nodes added at a depth. */
+	void created(const int level, const size_t n = 1) {
+		m_levels[level] += n;
+		m_total += n;
+		m_created += n;
+	}
+
+	/** Count nodes removed from a depth. */
+	void released(const int level, const size_t n = 1) {
+		assert(m_levels[level] >= n);
+		m_levels[level] -= n;
+		m_total -= n;
+		m_released += n;
+	}
+
+	/** Count a node which the tree already holds, such as one loaded from a
+	 * saved model, without counting it as created. */
+	void adopt(const int level) {
+		m_levels[level]++;
+		m_total++;
+	}
+
+	/** Count every node as released. */
+	void clear(void) {
+		std::fill(m_levels.begin(), m_levels.end(), 0);
+		m_released += m_total;
+		m_total = 0;
+	}
+
+	/** \return The number of nodes at a depth (the root is at depth 0). */
+	size_t level(const int level) const { return m_levels[level]; }
+
+	/** \return The number of nodes. */
+	size_t total(void) const { return m_total; }
+
+	/** \return The number of nodes created so far. */
+	size_t createdTotal(void) const { return m_created; }
+
+	/** \return The number of nodes released so far. */
+	size_t releasedTotal(void) const { return m_released; }
+
+private:
+	std::vector<size_t> m_levels;
+	size_t m_total;
+	size_t m_created;
+	size_t m_released;
+};
+
+
+/** A sequence of symbols, with the symbol at position i in bit i of
+ * SequencePrediction::sequence, and its estimated probability given the
+ * history (see ContextTree::predictSequences()). */
+struct SequencePrediction {
+	uint32_t sequence;
+	weight_t probability;
 };
 
 
 
 /** The high-level interface to an action-conditional context tree. Most of the
  * mathematical details are implemented in the CTNode class, which is used to
- * represent the nodes of the tree. ContextTree stores a reference to the root
- * node of the tree (ContextTree::m_root), the history of updates to the tree
- * (ContextTree::m_history), and the maximum depth of the tree
- * (ContextTree::m_depth). It is primarily concerned with calling the
- * appropriate functions in the appropriate nodes in order to deliver certain
- * functionality:
+ * represent the nodes of the tree, and the tree structure is maintained by an
+ * implementation of this interface such as ::ArenaContextTree. ContextTree
+ * stores the history of updates to the tree (ContextTree::m_history) and the
+ * maximum depth of the tree (ContextTree::m_depth). It is primarily concerned
+ * with calling the appropriate functions in the appropriate nodes in order to
+ * deliver certain functionality:
  * - Updating the context tree and reverting previously made updates.
  *   - ContextTree::update(symbol_t) and
  *     ContextTree::update(const symbol_list_t&) update the tree and the history
@@ -237,7 +672,9 @@ private:
  *     after the agent has executed an action.
  *   - ContextTree::revert() undoes the last update to the tree.
  *   - ContextTree::revertHistory() deletes the recent history.
- * - Predicting the probability of future outcomes (ContextTree::predict()).
+ * - Predicting the probability of future outcomes (ContextTree::predict()),
+ *   or of every sequence of a given length at once
+ *   (ContextTree::predictSequences()).
  * - Sampling sequences of symbols from the context tree statistics.
  *   - ContextTree::genRandomSymbolAndUpdate() samples a sequence from the
  *     context tree, updating the tree with each bit as it is sampled.
@@ -245,30 +682,100 @@ private:
  *     updating the tree with each bit as it is sampled, then reverting all the
  *     updates so that the tree is in the same state as it was before the
  *     sampling.
+ *
+ * Context trees are created with ContextTree::create(), which chooses the
+ * implementation according to the configuration options.
  */
 class ContextTree {
 public:
 
-	/** Create a context tree of specified maximum depth. Only allocates memory
-	 * for the root node, other nodes are created lazily as needed.
+	/** Create a context tree as described by the configuration options:
+	 *  - "ct-depth": the maximum depth of the context tree.
+	 *  - "ct-node-format" (optional): "standard" for ::CTNode, "compact" for
+	 *    ::CompactCTNode, "count-only" for ::CountOnlyCTNode, "compact-float"
+	 *    for ::CompactFloatCTNode or "compact-fixed" for
+	 *    ::CompactFixedCTNode. Ignored by a hashed tree, whose entries hold
+	 *    the statistics of a ::CTNode. Default value is "standard".
+	 *  - "ct-log-table-size" (optional): the number of counts for which the
+	 *    logarithms in the KT multipliers are tabulated (see
+	 *    CTNode::setLogTableSize()). Default value is 4096.
+	 *  - "ct-log-add" (optional): "exact" or "table", the way the weighted
+	 *    probabilities are mixed (see CTNode::setLogAddTable()). Default value
+	 *    is "exact".
+	 *  - "ct-backend" (optional): "arena" for an ::ArenaContextTree or
+	 *    "hashed" for a ::HashedContextTree. Default value is "arena".
+	 *  - "ct-model" (optional): "single" for one tree predicting every symbol
+	 *    or "factored" for a ::FactoredContextTree with one tree per percept
+	 *    bit. Default value is "single".
+	 *  - "ct-depth-1", "ct-depth-2", ... (optional): the depth of the tree for
+	 *    each percept bit of a factored model. Default value is "ct-depth".
+	 *  - "ct-context" (optional): the symbols of the history which form the
+	 *    context, as a comma-separated list of ages and ranges of ages such as
+	 *    "0-7,24,40-47", where age 0 is the symbol before the one predicted
+	 *    (see ContextTree::selectContext()). The depth of every tree becomes
+	 *    the length of the list, replacing "ct-depth" and "ct-depth-1", ...
+	 *    Default value is the most recent "ct-depth" symbols in order.
+	 *  - "ct-threads" (optional): the number of threads which update the trees
+	 *    of a factored model. Default value is 1.
+	 *  - "ct-revert" (optional): "journal" to undo updates by restoring saved
+	 *    nodes (see ArenaContextTree::journal()) or "recompute" to undo them
+	 *    arithmetically. Default value is "journal".
+	 *  - "ct-expand" (optional): "eager" to create every node on the path of a
+	 *    new context or "lazy" to stand for the nodes near the maximum depth
+	 *    with a single chain node until a second context needs them (see
+	 *    ArenaContextTree::updateContext()). The predictions are the same.
+	 *    Ignored by a hashed tree. Default value is "eager".
+	 *  - "ct-max-nodes" (optional): the number of nodes above which
+	 *    ContextTree::prune() shrinks the model. Shared evenly between the
+	 *    trees of a factored model. A hashed tree instead allocates the
+	 *    largest power of two entries within its share of the limit, where
+	 *    no limit means 2^20 entries. Default value is 0 (no limit).
+	 *  - "ct-max-bytes" (optional): the same limit expressed as the memory
+	 *    held by the nodes. The smaller of the two limits applies. Default
+	 *    value is 0 (no limit).
+	 *  - "huge-pages" (optional): true to allocate the node arenas, and
+	 *    those of overlays, on huge pages where the system provides them
+	 *    (see allocatePages()). Ignored by a hashed tree. Default value is
+	 *    false.
+	 *  - "load-model" (optional): a file saved by ContextTree::save() to start
+	 *    from. The depth and node format of the saved tree replace "ct-depth"
+	 *    and "ct-node-format". Requires "ct-model" to be "single",
+	 *    "ct-backend" to be "arena" and no "ct-context".
+	 *  - "save-model" (optional): checked here, so that a model which cannot
+	 *    be saved is reported before the agent runs. Requires "ct-model" to be
+	 *    "single", "ct-backend" to be "arena" and no "ct-context".
+	 *
+	 * The size of a node and the number of bytes saved per node relative to
+	 * ::CTNode are recorded in the "ct-node-bytes" and "ct-node-bytes-saved"
+	 * options (the saving is negative for a larger node), and the largest error of the "ct-log-add" table in
+	 * "ct-log-add-error". With "huge-pages", the bytes allocated so far with
+	 * huge pages requested and those actually backed by huge pages are
+	 * recorded in "huge-page-bytes" and "huge-page-bytes-obtained". The
+	 * program exits if the options are invalid.
 	 *
-	 * \param depth The maximum depth of the context tree. */
-	ContextTree(const int depth);
+	 * \param options The configuration options.
+	 * \param revert_bits The largest number of symbols which will be reverted
+	 * past the current history, e.g. during a search. The tree stores enough
+	 * of the history to revert these and still find their contexts.
+	 * \param percept_bits The number of bits in each percept.
+	 * \return A new, empty context tree. */
+	static ContextTree *create(options_t &options, const size_t revert_bits,
+		const int percept_bits);
 
 
 	/** Destroy the context tree and all the nodes referenced by the tree. */
-	~ContextTree(void);
+	virtual ~ContextTree(void) { }
 
 
 	/** Clears the entire context tree including all nodes and history. */
-	void clear(void);
+	virtual void clear(void) = 0;
 
 
 	/** Update the context tree with a new binary symbol. Recalculate the
 	 * log weighted probabilities and log KT estimates for each affected node.
 	 *
 	 * \param symbol The symbol with which to update the tree. */
-	void update(const symbol_t symbol);
+	virtual void update(const symbol_t symbol) = 0;
 
 
 	/** Update the context tree with a list of symbols. Equivalent to calling
@@ -276,34 +783,34 @@ public:
 	 *
 	 * \param symbols The symbols with which to update the tree. The context
 	 *  tree is updated with symbols in the order they appear in the list. */
-	void update(symbol_list_t const& symbols);
+	virtual void update(symbol_list_t const& symbols);
 
 
 	/** Append a symbol to the history without updating the context tree.
 	 *
 	 * \param symbol The symbol to add to the history. */
-	void updateHistory(const symbol_t symbol);
+	virtual void updateHistory(const symbol_t symbol);
 
 
 	/** Append symbols to the history without updating the context tree.
 	 *
 	 * \param symbols The list of symbols to add to the history. */
-	void updateHistory(symbol_list_t const& symbols);
+	virtual void updateHistory(symbol_list_t const& symbols);
 
 
 	/** Restores the context tree to as it was immediately prior to the previous
 	 * update (CTNode::update()). */
-	void revert(void);
+	virtual void revert(void) = 0;
 
 
 	/** Restores the context tree to its state prior to a specified number of
 	 * updates
 	 * \param num_symbols The number of updates (symbols) to revert. */
-	void revert(const int num_symbols);
+	virtual void revert(const int num_symbols);
 
 	/** Shrinks the history down to a former size without changing the context
 	 * tree. */
-	void revertHistory(const int num_symbols);
+	virtual void revertHistory(const int num_symbols);
 
 
 	/** The estimated probability of observing a particular symbol. Given a
@@ -313,10 +820,14 @@ public:
 	 * estimate of observing \f$ h \f$ evaluated at the root node
 	 * \f$ \epsilon \f$ of the context tree.
 	 *
+	 * The tree is not modified: \f$ \rho(hy) \f$ is computed by
+	 * ContextTree::logBlockProbabilityAfter(), so predictions do not allocate
+	 * and may be made concurrently on a shared tree.
+	 *
 	 * \param symbol The symbol to estimate the conditional probability of. A
 	 * false value corresponds to \f$ \rho(0 | h) \f$ and a true value to
 	 * \f$ \rho(1 | h) \f$. */
-	weight_t predict(const symbol_t symbol);
+	weight_t predict(const symbol_t symbol) const;
 
 
 	/** The estimated probability of observing a particular sequence of symbols.
@@ -332,6 +843,37 @@ public:
 	weight_t predict(symbol_list_t const& symbols);
 
 
+	/** The estimated probability of every sequence of a given length, or of
+	 * the most probable ones. Calling ContextTree::predict(const
+	 * symbol_list_t&) for each sequence would make bits updates and
+	 * reversions per sequence. Here the sequences are enumerated depth first
+	 * over the tree of their prefixes, so a prefix shared by several
+	 * sequences is added to the tree once: all \f$ 2^\text{bits} \f$
+	 * sequences cost \f$ 2^\text{bits} - 2 \f$ updates and as many
+	 * reversions, plus one ContextTree::predict(const symbol_t) per prefix.
+	 * Each symbol is predicted after learning the earlier ones, so the
+	 * probabilities are those of ContextTree::predict(const symbol_list_t&).
+	 * As when sampling (ContextTree::genRandomSymbolAndUpdate()), the
+	 * probability of a zero is taken as one minus that of a one, so the
+	 * probabilities sum to one. With a limit, a prefix no more probable than
+	 * the least of the best sequences found so far cannot lead to a better
+	 * one, and is skipped. The tree is left as it was.
+	 *
+	 * \param bits The length of the sequences, at most
+	 * ContextTree::cMaxSequenceBits without a limit and at most 31 with one.
+	 * \param predictions Receives every sequence in order, so that element
+	 * i is sequence i, or with a limit the most probable sequences, most
+	 * probable first.
+	 * \param limit The number of most probable sequences wanted, or 0 for
+	 * all of them. */
+	void predictSequences(const int bits,
+		std::vector<SequencePrediction> &predictions, const size_t limit = 0);
+
+	/** The longest sequences ContextTree::predictSequences() lists in full:
+	 * 65536 of them. Longer ones need a limit. */
+	static const int cMaxSequenceBits = 16;
+
+
 	/** Generate a bit string of a specified length by sampling from the context
 	 * tree.
 	 *
@@ -348,8 +890,22 @@ public:
 	void genRandomSymbolsAndUpdate(symbol_list_t &symbols, const int bits);
 
 
+	/** Sample a single symbol from the context tree and update the tree with
+	 * it. The context path is walked once: the probability of a one and the
+	 * state each node would have after a one are computed together, so a
+	 * sampled one is committed without recomputing the path.
+	 * \return The sampled symbol. */
+	virtual symbol_t genRandomSymbolAndUpdate(void) = 0;
+
+
 	/** The logarithm of the block probability of the history sequence. */
-	double logBlockProbability(void) const;
+	virtual double logBlockProbability(void) const = 0;
+
+	/** The logarithm of the block probability the history sequence would have
+	 * if it were extended by a symbol, computed without modifying the tree.
+	 * Requires at least ContextTree::depth() symbols of history.
+	 * \param symbol The hypothetical next symbol. */
+	virtual double logBlockProbabilityAfter(const symbol_t symbol) const = 0;
 
 
 	/** \return The maximum depth of the context tree. */
@@ -358,33 +914,882 @@ public:
 	/** \return The size of the stored history. */
 	size_t historySize(void) const { return m_history.size(); }
 
+	/** Form the context from chosen symbols of the history rather than the
+	 * most recent ContextTree::depth() symbols (see History::selectContext()).
+	 * Uninformative symbols can then be left out, so that a shallower tree
+	 * predicts as well and each update touches fewer nodes. The symbol at
+	 * age a, where age 0 is the most recent symbol of the history, selects
+	 * the child at depth k + 1 if a is entry k of the list. Predictions are
+	 * made once the history reaches the oldest symbol chosen. The tree must
+	 * be empty.
+	 * \param ages The age of the symbol which selects the child at each
+	 * depth, one for each level of the tree. */
+	virtual void selectContext(const std::vector<size_t> &ages);
+
 	/** \return number of nodes in the context tree. */
-	size_t size(void) const { return m_root ? m_root->size() : 0; }
+	virtual size_t size(void) const = 0;
 
-private:
+	/** \return The number of nodes at a depth of the tree, where the root is
+	 * at depth 0. Like ContextTree::size(), this is kept up to date as the
+	 * tree changes rather than counted when asked. */
+	virtual size_t levelSize(const int level) const {
+		return m_counts.level(level);
+	}
 
-	/** Calculates which nodes in the context tree correspond to the current
-	 * context and adds them to CTNode::m_context in order from root to leaf. In
-	 * particular, ContextTree::m_context[0] will always correspond to the roo
-	 * node and ContextTree::m_context [m_depth] corresponds to the relevant
-	 * leaf node. Creates the nodes if they do not exist. */
-	void updateContext(void);
+	/** \return The number of nodes the tree has created since it was made,
+	 * including those created by updates which were later reverted. Nodes
+	 * loaded from a saved model are not counted. */
+	virtual size_t nodesCreated(void) const { return m_counts.createdTotal(); }
 
-	/** An array of length CTNode::m_depth + 1 used to hold the nodes in the
-	 * context tree that correspond to the current context. It is important to
-	 * ensure that ContextTree::updateContext() is called before accessing the
-	 * contents of this array as they may otherwise be inaccurate. */
-	CTNode **m_context;
+	/** \return The number of nodes the tree has released since it was made,
+	 * by reverting updates, pruning or clearing. */
+	virtual size_t nodesReleased(void) const {
+		return m_counts.releasedTotal();
+	}
 
-	/** The agent's history. */
-	symbol_list_t m_history;
+	/** Keep the tree within its node budget ("ct-max-nodes" and "ct-max-bytes"
+	 * in ContextTree::create()). If the tree has grown past the budget,
+	 * rarely visited subtrees are cut off until it is comfortably below it.
+	 * Updates made before pruning can no longer be reverted exactly, so
+	 * this must only be called between searches, while no overlay is in use.
+	 * \return The number of nodes released. */
+	virtual size_t prune(void) { return 0; }
+
+	/** Move the nodes so that walking a context path from the root touches
+	 * as few cache lines as possible. Like ContextTree::prune(), this must
+	 * only be called between searches, while no overlay is in use.
+	 * \return True if the nodes were moved, false if the implementation does
+	 * not move its nodes. */
+	virtual bool compact(void) { return false; }
+
+	/** The path-walk cost of the tree: the average number of times an
+	 * update's walk from the root to its context moves from a node to a child
+	 * which is neither on the same 64-byte cache line nor on the next one, so
+	 * that the processor is unlikely to have fetched it already. Each path is
+	 * weighted by the number of updates which took it.
+	 * \return The cost, or 0 if the tree is empty or the implementation does
+	 * not measure it. */
+	virtual double pathCost(void) const { return 0.0; }
+
+	/** \return The number of bytes of memory held by the nodes and the
+	 * journal of the tree. Memory held by the node arena is counted even
+	 * when no node is using it. */
+	virtual size_t memoryUsage(void) const = 0;
+
+	/** \return The number of bytes of memory used by the nodes of the tree:
+	 * ContextTree::memoryUsage() less the journal and the room the arena or
+	 * table has to spare. */
+	virtual size_t nodeBytes(void) const = 0;
+
+	/** Save the tree and the end of the history to a file, in the format
+	 * described by ::ModelHeader. The file can be loaded with the "load-model"
+	 * option of ContextTree::create(). Enough history is saved to give the
+	 * context of the next symbol; updates cannot be reverted past it.
+	 * \param path The file to write.
+	 * \return True on success, false if the file could not be written or
+	 * the implementation does not support saving. */
+	virtual bool save(const std::string & /* path */) const {
+		return false;
+	}
 
-	/** The root node of the context tree. */
-	CTNode *m_root;
+	/** Create an overlay on this tree: a ::ContextTree which starts in the
+	 * same state and can be updated without modifying this tree (see
+	 * ::OverlayContextTree). This tree must not change while the overlay is
+	 * in use, but any number of overlays may read it concurrently.
+	 * \return A new overlay, or NULL if the implementation does not support
+	 * overlays. */
+	virtual ContextTree *createOverlay(void) const { return NULL; }
+
+protected:
+
+	/** Enumerate the sequences for ContextTree::predictSequences() which
+	 * extend a prefix already added to the tree.
+	 * \param bits The length of the sequences.
+	 * \param position The length of the prefix.
+	 * \param prefix The prefix, as in SequencePrediction::sequence.
+	 * \param probability The estimated probability of the prefix.
+	 * \param predictions The sequences found so far: all of them, or with a
+	 * limit a heap of the most probable, least probable first.
+	 * \param limit See ContextTree::predictSequences(). */
+	void predictSequences(const int bits, const int position,
+		const uint32_t prefix, const weight_t probability,
+		std::vector<SequencePrediction> &predictions, const size_t limit);
+
+	/** Initialise the history and depth of a context tree.
+	 * \param depth The maximum depth of the context tree.
+	 * \param revert_bits See ContextTree::create(). */
+	ContextTree(const int depth, const size_t revert_bits);
+
+	/** The agent's history. Only the most recent ContextTree::m_depth symbols
+	 * plus those which may be reverted are stored. */
+	History m_history;
 
 	/** The maximum depth of the context tree. */
 	int m_depth;
 
+	/** The number of history symbols needed to give the context of the next
+	 * symbol: ContextTree::m_depth unless ContextTree::selectContext() has
+	 * chosen older symbols. */
+	size_t m_context_span;
+
+	/** The number of nodes at each depth of the tree, kept by the
+	 * implementations which create and release nodes. */
+	NodeCounts m_counts;
+};
+
+
+
+/** A ::ContextTree whose nodes are linked by index and owned by an ::Arena
+ * (ArenaContextTree::m_nodes). The Node parameter selects the node
+ * representation: ::CTNode or a ::CountingCTNode. ArenaContextTree keeps the
+ * index of the root node of the tree (ArenaContextTree::m_root) and the nodes
+ * on the path for the current context (ArenaContextTree::m_context). */
+template <class Node>
+class ArenaContextTree : public ContextTree {
+public:
+
+	/** Create a context tree of specified maximum depth. Only allocates the
+	 * root node, other nodes are created lazily as needed.
+	 *
+	 * \param depth The maximum depth of the context tree.
+	 * \param revert_bits See ContextTree::create(). This many of the most
+	 * recent updates are journaled.
+	 * \param journal False to revert every update by recomputing the nodes,
+	 * without journaling.
+	 * \param max_nodes The node budget enforced by ArenaContextTree::prune(),
+	 * or 0 for no limit.
+	 * \param lazy True to end the path for a new context at a chain node
+	 * rather than creating every node down to the maximum depth (see
+	 * ArenaContextTree::updateContext()).
+	 * \param huge_pages True to allocate the node arena on huge pages (see
+	 * Arena::useHugePages()).
+	 * \param model A saved tree of the same depth and node format to start
+	 * from, or NULL to start empty. The tree adopts the saved nodes in place
+	 * and takes ownership of the model. */
+	ArenaContextTree(const int depth, const size_t revert_bits,
+		const bool journal, const size_t max_nodes, const bool lazy,
+		const bool huge_pages, ModelFile *model);
+
+	/** Destroy the context tree. The nodes are freed with the arena. */
+	virtual ~ArenaContextTree(void);
+
+	virtual void clear(void);
+
+	virtual void update(const symbol_t symbol);
+	using ContextTree::update;
+
+	virtual void revert(void);
+	using ContextTree::revert;
+
+	virtual double logBlockProbability(void) const;
+
+	virtual double logBlockProbabilityAfter(const symbol_t symbol) const;
+
+	virtual symbol_t genRandomSymbolAndUpdate(void);
+
+	virtual size_t size(void) const;
+
+	/** Prune the tree down to 90% of its budget once it exceeds it. Each
+	 * pruned node becomes a permanent leaf whose weighted probability is its
+	 * own KT estimate. Its counts already include those of the released
+	 * descendants, so no observations are lost, only the deeper contexts in
+	 * which they were seen. The nodes pruned are those with the fewest
+	 * visits; since visits never increase along a path, they lie deep in the
+	 * tree. The weighted probabilities of their ancestors are recomputed and
+	 * the journal is emptied. */
+	virtual size_t prune(void);
+
+	/** Copy the nodes into a new arena in the order of
+	 * ArenaContextTree::depthFirstOrder(), so that they are contiguous and a
+	 * context path mostly runs forward through memory, and release the old
+	 * arena. The memory of both arenas is held while copying. Nodes adopted
+	 * from a saved model are copied too, and the model is released. The
+	 * journal is emptied. */
+	virtual bool compact(void);
+
+	virtual double pathCost(void) const;
+
+	virtual size_t memoryUsage(void) const;
+
+	virtual size_t nodeBytes(void) const {
+		return m_counts.total() * sizeof(Node);
+	}
+
+	/** Save the tree with its nodes numbered by
+	 * ArenaContextTree::depthFirstOrder(), so that the saved nodes are
+	 * contiguous and each subtree is stored in one piece. */
+	virtual bool save(const std::string &path) const;
+
+	virtual ContextTree *createOverlay(void) const;
+
+private:
+
+	friend class OverlayContextTree<Node>;
+
+	/** Count, for each number of visits, the nodes which pruning every node
+	 * with at most that many visits would release. A node is released when
+	 * its parent is pruned, and the root is never pruned.
+	 * \param index The node whose descendants are counted.
+	 * \param released Accumulates the counts, keyed by the parent's visits. */
+	void countPrunable(const arena_index_t index,
+		std::map<int, size_t> &released) const;
+
+	/** Prune the nodes below an index with at most a given number of visits,
+	 * until the tree is down to a target size.
+	 * \param index The node to start from.
+	 * \param level The depth of the node.
+	 * \param max_visits Nodes with no more visits than this are pruned.
+	 * \param target Pruning stops once the tree has this many nodes.
+	 * \return True if the weighted probability of the node changed. */
+	bool pruneSubtree(const arena_index_t index, const int level,
+		const int max_visits, const size_t target);
+
+	/** A node whose children ArenaContextTree::pruneSubtree() is visiting. */
+	struct PruneFrame {
+		/** The index of the node. */
+		arena_index_t index;
+
+		/** The depth of the node. */
+		int level;
+
+		/** The child to visit next; 2 once both have been visited. */
+		int next;
+
+		/** True if pruning below the node changed its weighted
+		 * probability. */
+		bool changed;
+	};
+
+	/** Release the descendants of a node at a given depth back to the
+	 * arena. */
+	void releaseChildren(const arena_index_t index, const int level);
+
+	/** Count the nodes of a tree loaded from a saved model in
+	 * ContextTree::m_counts, checking that they form a tree. This runs before
+	 * the nodes are adopted, so no link is followed unchecked.
+	 * \param nodes The saved nodes.
+	 * \return False if a link leads outside the file, below the maximum
+	 * depth or to a node already reached, or if some node is not reached. */
+	bool countSavedNodes(const Node *nodes);
+
+	/** Number the nodes from 1 in depth-first order from the root, visiting
+	 * the more visited child of each node first. The likelier of two
+	 * contexts therefore continues with the next node, and each subtree is
+	 * numbered in one block.
+	 * \param order Receives the index of each node by number, starting with
+	 * ::null_index for number 0.
+	 * \param number Receives the number of each node by index, and
+	 * ::null_index for indices not in the tree. */
+	void depthFirstOrder(std::vector<arena_index_t> &order,
+		std::vector<arena_index_t> &number) const;
+
+	/** The log weighted probability that a node on the current context path
+	 * would have after observing a symbol. Works bottom-up from the leaf,
+	 * reading the unchanged probability of the sibling off the path at each
+	 * level. A missing node stands for an empty subtree, whose probability is
+	 * looked up in ArenaContextTree::m_log_empty_after without visiting its
+	 * levels.
+	 * \param index The node, or ::null_index if it does not exist.
+	 * \param level The depth of the node in the tree (the root is at 0).
+	 * \param symbol The hypothetical next symbol. */
+	double logProbabilityAfter(const arena_index_t index, const int level,
+		const symbol_t symbol) const;
+
+	/** The log weighted probability that a chain node on the current
+	 * context path would have after observing a symbol, found without
+	 * expanding it.
+	 * \param node The chain node.
+	 * \param agreement Its CTNode::chainAgreement() with the context.
+	 * \param levels The number of levels below the node.
+	 * \param symbol The hypothetical next symbol. */
+	static double chainProbabilityAfter(const Node &node, const int agreement,
+		const int levels, const symbol_t symbol);
+
+	/** Calculates which nodes in the context tree correspond to the current
+	 * context and adds them to ArenaContextTree::m_context in order from root
+	 * to leaf. In particular, ArenaContextTree::m_context[0] will always
+	 * correspond to the root node and ArenaContextTree::m_context[m_depth]
+	 * corresponds to the relevant leaf node. Creates the nodes if they do not
+	 * exist.
+	 *
+	 * When lazy, a new node within ::chain_levels of the maximum depth is
+	 * created as a chain node, which ends the path: a context seen once costs
+	 * one node instead of one per remaining level. A chain the context
+	 * follows ends the path too. One the context leaves is expanded a level
+	 * at a time, until the context and the chain diverge and the chain's
+	 * remainder is left as the sibling of the new path
+	 * (ArenaContextTree::m_orphan). Every node of a chain has the same
+	 * counts, so the tree computes the same probabilities as one whose nodes
+	 * are all created.
+	 *
+	 * \param lazy True to create chain nodes: ArenaContextTree::m_lazy for an
+	 * update which is kept, and always for an update made while sampling,
+	 * which the search reverts, so that simulating a novel context creates
+	 * one node rather than a path to the maximum depth. */
+	void updateContext(const bool lazy);
+
+	/** Save the nodes on the context path, as found by
+	 * ArenaContextTree::updateContext(), before they are updated. The
+	 * journal holds the nodes of the last ArenaContextTree::m_journal_capacity
+	 * updates, so that ArenaContextTree::revert() can undo them by copying the
+	 * nodes back instead of recomputing their probabilities. Older updates
+	 * are forgotten and reverted by recomputation. */
+	void journal(void);
+
+	/** Undo the most recent update recorded by ArenaContextTree::journal(),
+	 * releasing the nodes it created. */
+	void restore(void);
+
+	/** The arena which owns every node in the context tree. Nodes are taken
+	 * from and returned to the arena as the tree grows and shrinks, so updates
+	 * and reversions do not allocate memory once the arena has grown to the
+	 * size of the tree. */
+	Arena<Node> m_nodes;
+
+	/** An array of length ContextTree::m_depth + 1 used to hold the nodes in
+	 * the context tree that correspond to the current context. It is important
+	 * to ensure that ArenaContextTree::updateContext() is called before
+	 * accessing the contents of this array as they may otherwise be
+	 * inaccurate. Arena slabs never move, so the pointers remain valid while
+	 * new nodes are created. */
+	Node **m_context;
+
+	/** The indices of the nodes in ArenaContextTree::m_context. */
+	arena_index_t *m_path;
+
+	/** The depth of the last node on the context path, which is
+	 * ContextTree::m_depth unless the path ends at a pruned node or a chain
+	 * node. */
+	int m_leaf;
+
+	/** The depth of the first node on the context path which was created by
+	 * the last call to ArenaContextTree::updateContext(), or
+	 * ArenaContextTree::m_leaf + 1 if none was. Deeper nodes were created
+	 * too. */
+	int m_created;
+
+	/** The depth of the node on the context path which the last call to
+	 * ArenaContextTree::updateContext() expanded from an existing chain, or
+	 * -1 if none was, and the chain as it was
+	 * (ArenaContextTree::m_expanded_node). */
+	int m_expanded;
+	Node m_expanded_node;
+
+	/** The node off the context path created by the last call to
+	 * ArenaContextTree::updateContext() to hold the rest of a chain which
+	 * the context left, or ::null_index if none was, and its depth. */
+	arena_index_t m_orphan;
+	int m_orphan_level;
+
+	/** Arrays of length ContextTree::m_depth + 1 holding the KT estimate and
+	 * weighted probability each node in ArenaContextTree::m_context would
+	 * have after observing a one. Filled in by
+	 * ArenaContextTree::genRandomSymbolAndUpdate(). */
+	weight_t *m_log_kt_after;
+	weight_t *m_log_probability_after;
+
+	/** An array of length ContextTree::m_depth + 1 holding the weighted
+	 * probability an empty subtree rooted at each depth would have after
+	 * observing a symbol (either one, by symmetry). */
+	weight_t *m_log_empty_after;
+
+	/** The journal: a ring buffer of ArenaContextTree::m_journal_capacity
+	 * updates. For each update it holds the ContextTree::m_depth + 1 path
+	 * nodes as they were before the update, their indices, and the values of
+	 * ArenaContextTree::m_created (saved nodes at or below that depth are
+	 * unused), ArenaContextTree::m_leaf, ArenaContextTree::m_orphan and
+	 * ArenaContextTree::m_orphan_level. */
+	Node *m_journal_nodes;
+	arena_index_t *m_journal_path;
+	int *m_journal_created;
+	int *m_journal_leaf;
+	arena_index_t *m_journal_orphan;
+	int *m_journal_orphan_level;
+
+	/** The number of updates the journal can hold. */
+	size_t m_journal_capacity;
+
+	/** The number of updates currently in the journal. */
+	size_t m_journal_size;
+
+	/** The position in the journal of the next update. */
+	size_t m_journal_next;
+
+	/** The index of the root node of the context tree. */
+	arena_index_t m_root;
+
+	/** The node budget enforced by ArenaContextTree::prune(); 0 for none. */
+	size_t m_max_nodes;
+
+	/** True if new contexts end at chain nodes. See
+	 * ArenaContextTree::updateContext(). */
+	bool m_lazy;
+
+	/** The saved model whose nodes the arena has adopted, or NULL. */
+	ModelFile *m_model;
+};
+
+
+
+/** A copy-on-write view of an ::ArenaContextTree (the shared tree,
+ * OverlayContextTree::m_base). The overlay starts with the shared tree's nodes
+ * and history. Updates never touch the shared tree: each node on the context
+ * path is copied into the overlay's own arena (OverlayContextTree::m_nodes)
+ * the first time it changes, and new nodes are created there. Since every
+ * update changes the whole path from the root, the changed nodes form a tree
+ * of their own, whose links lead either to other changed nodes (indices
+ * tagged with OverlayContextTree::cOverlayBit) or back into the shared tree.
+ *
+ * OverlayContextTree::clear() discards every change, returning the overlay
+ * to the current state of the shared tree. The shared tree is only read, so
+ * several overlays on different threads can simulate the future (e.g. in the
+ * search) from one model without copying it.
+ *
+ * Updates made through the overlay are journaled until the next
+ * OverlayContextTree::clear(), so they can be reverted individually.
+ *
+ * The node counts (ContextTree::levelSize() and the numbers of nodes created
+ * and released) are those of the shared tree; OverlayContextTree::size()
+ * walks the tree seen through the overlay. */
+template <class Node>
+class OverlayContextTree : public ContextTree {
+public:
+
+	/** Create an overlay on a tree. See ContextTree::createOverlay().
+	 * \param base The shared tree. */
+	OverlayContextTree(const ArenaContextTree<Node> &base);
+
+	/** Discard the changes and return to the state of the shared tree. The
+	 * history is copied from the shared tree only if that has changed since
+	 * it was last copied; otherwise the symbols added through the overlay
+	 * are dropped. */
+	virtual void clear(void);
+
+	virtual void update(const symbol_t symbol);
+	using ContextTree::update;
+
+	/** Revert an update made through the overlay. Updates made to the shared
+	 * tree cannot be reverted. */
+	virtual void revert(void);
+	using ContextTree::revert;
+
+	virtual symbol_t genRandomSymbolAndUpdate(void);
+
+	virtual double logBlockProbability(void) const;
+
+	virtual double logBlockProbabilityAfter(const symbol_t symbol) const;
+
+	virtual size_t size(void) const;
+
+	virtual size_t memoryUsage(void) const;
+
+	/** \return The number of bytes used by the overlay's own nodes. */
+	virtual size_t nodeBytes(void) const {
+		return m_nodes.size() * sizeof(Node);
+	}
+
+	virtual size_t levelSize(const int level) const {
+		return m_base.levelSize(level);
+	}
+
+	virtual size_t nodesCreated(void) const { return m_base.nodesCreated(); }
+
+	virtual size_t nodesReleased(void) const {
+		return m_base.nodesReleased();
+	}
+
+private:
+
+	/** Marks the indices of the nodes in OverlayContextTree::m_nodes. Other
+	 * indices refer to the shared tree. */
+	static const arena_index_t cOverlayBit = 0x80000000u;
+
+	/** \return A node of the overlay or the shared tree. */
+	const Node &node(const arena_index_t index) const {
+		return (index & cOverlayBit) ? m_nodes[index & ~cOverlayBit] :
+			m_base.m_nodes[index];
+	}
+
+	/** Find the path for the current context, copying each node on it into
+	 * the overlay if it is not already there and creating missing nodes.
+	 * Chain nodes are created and expanded as in
+	 * ArenaContextTree::updateContext(). Fills OverlayContextTree::m_context
+	 * and journals the path nodes.
+	 * \param lazy See ArenaContextTree::updateContext(). */
+	void copyContext(const bool lazy);
+
+	/** Update the nodes in OverlayContextTree::m_context from leaf to root as
+	 * ArenaContextTree::update() would.
+	 * \param symbol The observed symbol. */
+	void updatePath(const symbol_t symbol);
+
+	/** See ArenaContextTree::logProbabilityAfter(). */
+	double logProbabilityAfter(const arena_index_t index, const int level,
+		const symbol_t symbol) const;
+
+	/** \return The number of nodes in the tree below an index. */
+	size_t size(const arena_index_t index) const;
+
+	/** The state of an overlay node before an update. */
+	struct JournalEntry {
+		/** The index of the node in OverlayContextTree::m_nodes. */
+		arena_index_t index;
+
+		/** True if the node was copied or created by the update, in which
+		 * case it is released rather than restored. */
+		bool allocated;
+
+		/** The node before the update. */
+		Node saved;
+	};
+
+	/** The shared tree. */
+	const ArenaContextTree<Node> &m_base;
+
+	/** The History::revision() of the shared tree's history when it was
+	 * last copied into the overlay. */
+	size_t m_base_revision;
+
+	/** The nodes changed through the overlay. */
+	Arena<Node> m_nodes;
+
+	/** The index of the root node, in the overlay once it has changed. */
+	arena_index_t m_root;
+
+	/** The overlay nodes on the current context path, from root to leaf. */
+	std::vector<Node *> m_context;
+
+	/** See ArenaContextTree::m_leaf. */
+	int m_leaf;
+
+	/** See ArenaContextTree::m_log_kt_after. */
+	std::vector<weight_t> m_log_kt_after;
+	std::vector<weight_t> m_log_probability_after;
+
+	/** The journal entries of every update since the last clear, and the
+	 * position of the first entry of each update. */
+	std::vector<JournalEntry> m_journal;
+	std::vector<size_t> m_journal_marks;
+};
+
+
+/** A ::ContextTree whose nodes are entries in a fixed-size hash table
+ * (HashedContextTree::m_table) rather than objects linked by index. The entry
+ * for the node at depth \f$ d \f$ is found by hashing its context, the
+ * \f$ d \f$ most recent symbols; the hash is built up one symbol at a time
+ * while walking down the path, so finding a node needs no pointer chasing and
+ * no links are stored. The table is allocated once, when the tree is created,
+ * and never grows.
+ *
+ * The table is open addressed. A node may live in any of the
+ * HashedContextTree::cWindow slots of the window its hash selects, and is
+ * identified by a key holding 54 bits of the hash and its depth. When a node
+ * is needed and every slot of its window is taken, the entry with the fewest
+ * visits is replaced, preferring deeper entries among equals; entries on the
+ * path being updated are never replaced. The statistics of a replaced node
+ * are lost, though its parent's weighted probability still counts them until
+ * the parent is next updated (see HashedContextTree::m_replaced). A node
+ * whose window is entirely taken by the path ends the path early, like a
+ * pruned node in an ::ArenaContextTree. Without replacements the tree
+ * computes exactly what an ::ArenaContextTree of ::CTNode does.
+ *
+ * Updates are journaled as in ArenaContextTree::journal(): the slots on the
+ * path are saved before the update and copied back to revert it, which also
+ * brings back the entries the update replaced. */
+class HashedContextTree : public ContextTree {
+public:
+
+	/** Create an empty hashed context tree.
+	 * \param depth The maximum depth of the context tree.
+	 * \param revert_bits See ArenaContextTree::ArenaContextTree().
+	 * \param journal See ArenaContextTree::ArenaContextTree().
+	 * \param entries The number of entries in the table, rounded down to a
+	 * power of two (at least HashedContextTree::cWindow). */
+	HashedContextTree(const int depth, const size_t revert_bits,
+		const bool journal, const size_t entries);
+
+	virtual void clear(void);
+
+	virtual void update(const symbol_t symbol);
+	using ContextTree::update;
+
+	virtual void revert(void);
+	using ContextTree::revert;
+
+	/** Sample a symbol and update the tree with it in a single walk of the
+	 * path. See ArenaContextTree::genRandomSymbolAndUpdate(). */
+	virtual symbol_t genRandomSymbolAndUpdate(void);
+
+	virtual double logBlockProbability(void) const;
+
+	virtual double logBlockProbabilityAfter(const symbol_t symbol) const;
+
+	/** \return The number of entries in use. */
+	virtual size_t size(void) const { return m_counts.total(); }
+
+	virtual size_t memoryUsage(void) const;
+
+	virtual size_t nodeBytes(void) const {
+		return m_counts.total() * entryBytes();
+	}
+
+	/** \return The size of a table entry, with its key, in bytes. */
+	static size_t entryBytes(void) { return sizeof(Entry) + sizeof(uint64_t); }
+
+private:
+
+	/** The statistics of a node: see ::CTNode. */
+	struct Entry {
+		/** See CTNode::m_log_kt. */
+		weight_t log_kt;
+
+		/** See CTNode::m_log_probability. */
+		weight_t log_probability;
+
+		/** See CTNode::m_count. */
+		count_t count[2];
+	};
+
+	/** The number of slots in which a node may live. The slots form an
+	 * aligned window, whose keys share a cache line. */
+	static const size_t cWindow = 8;
+
+	/** Set in the key of every entry in use. */
+	static const uint64_t cUsedBit = uint64_t(1) << 63;
+
+	/** Set in the key of the entries on the path being updated, which must
+	 * not be replaced. */
+	static const uint64_t cPinBit = 1;
+
+	/** The hash of the root's (empty) context. */
+	static const uint64_t cRootHash = 0x6A09E667F3BCC908ull;
+
+	/** \return The hash of the context of a node's child.
+	 * \param hash The hash of the node's context.
+	 * \param symbol The symbol preceding the node's context. */
+	static uint64_t childHash(const uint64_t hash, const symbol_t symbol);
+
+	/** \return The key of the node with a given hash and depth. */
+	static uint64_t key(const uint64_t hash, const int level) {
+		return (hash & ~uint64_t(0x1FF)) | (uint64_t(level) << 1) | cUsedBit;
+	}
+
+	/** \return The depth of the node a key was made for. */
+	static int keyLevel(const uint64_t key) { return int((key >> 1) & 0xFF); }
+
+	/** \return The slot holding a node, or HashedContextTree::cNoSlot. */
+	size_t find(const uint64_t hash, const int level) const;
+
+	/** Find the slot of a node, claiming one for it if it is not in the
+	 * table. The previous contents of the slot are saved in
+	 * HashedContextTree::m_saved[level].
+	 * \return The slot, or HashedContextTree::cNoSlot if every slot of the
+	 * window is pinned. */
+	size_t insert(const uint64_t hash, const int level);
+
+	/** Fill HashedContextTree::m_path, HashedContextTree::m_hash and
+	 * HashedContextTree::m_sibling with the nodes for the current context,
+	 * from root to leaf, and set HashedContextTree::m_leaf.
+	 * \param create True to insert missing nodes and pin the path, false to
+	 * end the path at the first missing node. */
+	void findContext(const bool create);
+
+	/** Start loading the window of a node into the cache. */
+	void prefetch(const uint64_t hash) const;
+
+	/** \return The weighted log probability of the node at a level of the
+	 * path, given its KT estimate and the weighted log probability of its
+	 * child on the path. See CTNode::updateLogProbability(). */
+	double logProbability(const int level, const double log_kt,
+		const double log_path_prob) const;
+
+	/** Update the nodes on the path with a symbol, from leaf to root, and
+	 * unpin them. */
+	void updatePath(const symbol_t symbol);
+
+	/** See ArenaContextTree::logProbabilityAfter().
+	 * \param hash The hash of the node's context.
+	 * \param log_before If not NULL, receives the node's weighted log
+	 * probability recalculated from the entries below it on the path. */
+	double logProbabilityAfter(const uint64_t hash, const int level,
+		const symbol_t symbol, double *log_before) const;
+
+	/** Record the saved slots of the path in the journal. See
+	 * ArenaContextTree::journal(). */
+	void journal(void);
+
+	/** Undo the most recent journaled update. */
+	void restore(void);
+
+	/** Marks a node which is not in the table. */
+	static const size_t cNoSlot = ~size_t(0);
+
+	/** The keys of the hash table. The key of an entry holds
+	 * HashedContextTree::cUsedBit, 54 bits of the hash of its context, its
+	 * depth and HashedContextTree::cPinBit, and is zero if the slot is
+	 * empty. The keys are kept apart from the entries so that searching a
+	 * window reads a single cache line. */
+	std::vector<uint64_t> m_keys;
+
+	/** The entries of the hash table. */
+	std::vector<Entry> m_table;
+
+	/** The size of the table, less one. */
+	size_t m_mask;
+
+
+	/** True once an entry has been replaced. The parent of a replaced entry
+	 * keeps a weighted probability which counts it, so from then on a
+	 * prediction divides by the probability of the path recalculated from
+	 * the entries in the table rather than by the root's, which keeps
+	 * ContextTree::predict() normalised. */
+	bool m_replaced;
+
+	/** The slots and context hashes of the nodes on the current path. */
+	std::vector<size_t> m_path;
+	std::vector<uint64_t> m_hash;
+
+	/** The slot and context hash of the child of each node on the path which
+	 * is not on the path. The slot is HashedContextTree::cNoSlot if the child
+	 * is not in the table. */
+	std::vector<size_t> m_sibling;
+	std::vector<uint64_t> m_sibling_hash;
+
+	/** The KT estimate and weighted probability of each node on the path
+	 * after a one. See ArenaContextTree::m_log_kt_after. */
+	std::vector<weight_t> m_log_kt_after;
+	std::vector<weight_t> m_log_probability_after;
+
+	/** The depth of the last node on the current path. */
+	int m_leaf;
+
+	/** The contents of the slots of the path before they were claimed by
+	 * HashedContextTree::insert(). */
+	std::vector<Entry> m_saved;
+	std::vector<uint64_t> m_saved_keys;
+
+	/** The journal: for each update, the saved slots, their indices and the
+	 * leaf of the path. See ArenaContextTree::m_journal_nodes. */
+	std::vector<Entry> m_journal_entries;
+	std::vector<uint64_t> m_journal_keys;
+	std::vector<size_t> m_journal_path;
+	std::vector<int> m_journal_leaf;
+
+	/** See ArenaContextTree::m_journal_capacity. */
+	size_t m_journal_capacity;
+
+	/** See ArenaContextTree::m_journal_size. */
+	size_t m_journal_size;
+
+	/** See ArenaContextTree::m_journal_next. */
+	size_t m_journal_next;
+};
+
+
+
+/** A ::ContextTree which models each bit of a percept with a separate tree, as
+ * in factored action-conditional CTW. The tree for percept bit \f$ i \f$
+ * (FactoredContextTree::m_trees[i]) sees the whole history as context, but is
+ * only updated with bit \f$ i \f$ of each percept. The probability of a
+ * percept is the product of the predictions of each tree in turn. Each tree
+ * has its own depth and is smaller than a single tree for every bit, and the
+ * trees can be updated independently.
+ *
+ * Symbols passed to FactoredContextTree::update() and
+ * FactoredContextTree::revert() are taken to be percept bits; the position
+ * within the current percept (FactoredContextTree::m_position) selects the
+ * tree. Symbols passed to FactoredContextTree::updateHistory() (actions) are
+ * only appended to the history. Actions are not modelled, so
+ * ContextTree::predict() and ContextTree::genRandomSymbols() apply to percepts
+ * only.
+ *
+ * Every tree keeps a copy of the history, so updating a whole percept with
+ * FactoredContextTree::update(const symbol_list_t&), or reverting one, is a
+ * set of independent operations on the trees. These are spread over a
+ * ::ThreadPool when there is one. */
+class FactoredContextTree : public ContextTree {
+public:
+
+	/** Create a factored context tree from the trees for each percept bit.
+	 * \param trees The tree for each percept bit, in order. The factored
+	 * tree takes ownership of the trees.
+	 * \param revert_bits See ContextTree::create().
+	 * \param threads The number of threads used to update the trees. */
+	FactoredContextTree(const std::vector<ContextTree *> &trees,
+		const size_t revert_bits, const int threads);
+
+	/** Destroy the trees and the thread pool. */
+	virtual ~FactoredContextTree(void);
+
+	virtual void clear(void);
+
+	virtual void update(const symbol_t symbol);
+	virtual void update(symbol_list_t const& symbols);
+
+	virtual void updateHistory(const symbol_t symbol);
+	virtual void updateHistory(symbol_list_t const& symbols);
+
+	virtual void revert(void);
+	virtual void revert(const int num_symbols);
+
+	virtual void revertHistory(const int num_symbols);
+
+	virtual symbol_t genRandomSymbolAndUpdate(void);
+
+	virtual double logBlockProbability(void) const;
+
+	virtual double logBlockProbabilityAfter(const symbol_t symbol) const;
+
+	virtual size_t size(void) const;
+
+	/** \return The number of nodes at a depth of any of the trees. */
+	virtual size_t levelSize(const int level) const;
+
+	virtual size_t nodesCreated(void) const;
+
+	virtual size_t nodesReleased(void) const;
+
+	/** Prune each tree to its share of the budget. */
+	virtual size_t prune(void);
+
+	/** Compact each tree. */
+	virtual bool compact(void);
+
+	/** Select the same context for each tree. */
+	virtual void selectContext(const std::vector<size_t> &ages);
+
+	/** The mean path-walk cost of the trees. */
+	virtual double pathCost(void) const;
+
+	virtual size_t memoryUsage(void) const;
+
+	virtual size_t nodeBytes(void) const;
+
+private:
+
+	/** Update tree i with bit i of FactoredContextTree::m_percept, and its
+	 * history with the other bits. A ThreadPool::task_t. */
+	static void updateTask(void *context, const int i);
+
+	/** Revert bit i of the last percept from tree i, and the other bits from
+	 * its history. A ThreadPool::task_t. */
+	static void revertTask(void *context, const int i);
+
+	/** Run a task for every tree, on the thread pool if there is one. */
+	void runTasks(void (*task)(void *, const int));
+
+	/** The tree for each percept bit. */
+	std::vector<ContextTree *> m_trees;
+
+	/** The index of the tree which models the next percept bit. */
+	int m_position;
+
+	/** The percept being added by FactoredContextTree::updateTask(). */
+	const symbol_list_t *m_percept;
+
+	/** Runs updates and reversions on several threads; NULL to run them on
+	 * the calling thread. */
+	ThreadPool *m_pool;
 };
 
 #endif // __PREDICT_HPP__
@@ -8,21 +8,23 @@
 /** Exploration constant for UCB action policy. */
 static const double exploration_constant = 2.0;
 
-SearchNode::SearchNode(const nodetype_t nodetype) {
+SearchNode::SearchNode(void) {
+	m_self = null_index;
 	m_mean = 0;
 	m_visits = 0;
-	m_type = nodetype;
+	m_type = decision;
 }
 
-SearchNode::~SearchNode(void) {
-	child_map_t::iterator child_iter = m_child.begin();
-	for( ; child_iter != m_child.end(); child_iter++) {
-		delete child_iter->second;
-	}
+SearchNode::SearchNode(const nodetype_t nodetype) {
+	m_self = null_index;
+	m_mean = 0;
+	m_visits = 0;
+	m_type = nodetype;
 }
 
 // Select an action according to UCB policy
-action_t SearchNode::selectAction(Agent const& agent) {
+action_t SearchNode::selectAction(Agent const& agent,
+		const SearchTree &tree) const {
 	const double explore_bias = agent.horizon() * agent.maxReward();
 	const double unexplored_bias = 1000000000.0;
 	const double log_visits = std::log((double) visits());
@@ -31,7 +33,7 @@ action_t SearchNode::selectAction(Agent const& agent) {
 	action_t best_action;
 	double best_priority = -std::numeric_limits<double>::infinity();
 	for (action_t a = 0; a <= agent.maxAction(); a++) {
-		SearchNode *n = child(a);
+		const SearchNode *n = tree.child(*this, a);
 
 		// Use UCB formula to determine priority of node
 		double priority = 0.0;
@@ -54,7 +56,8 @@ action_t SearchNode::selectAction(Agent const& agent) {
 }
 
 
-reward_t SearchNode::sample(Agent &agent, const int horizon) {
+reward_t SearchNode::sample(Agent &agent, SearchTree &tree,
+		const int horizon) {
 	reward_t reward = 0.0;
 
 	// If we have reached the agents horizon or the maximum search depth then
@@ -69,9 +72,10 @@ reward_t SearchNode::sample(Agent &agent, const int horizon) {
 		percept_t o, r;
 		agent.genPerceptAndUpdate(o, r);
 
-		if (!child(o))
-			m_child[o] = new SearchNode(decision);
-		reward = r + m_child[o]->sample(agent, horizon - 1);
+		SearchNode *n = tree.child(*this, o);
+		if (!n)
+			n = &tree.addChild(*this, o, decision);
+		reward = r + n->sample(agent, tree, horizon - 1);
 	}
 	else if (visits() == 0) {
 		// We are at a decision node. Either the node is previously unvisited or
@@ -82,12 +86,13 @@ reward_t SearchNode::sample(Agent &agent, const int horizon) {
 	else {
 		// We are at a decision node, choose an action according to the UCB
 		// policy and continue sampling.
-		action_t a = selectAction(agent);
+		action_t a = selectAction(agent, tree);
 		agent.modelUpdate(a);
 
-		if (child(a) == NULL)
-			m_child[a] = new SearchNode(chance);
-		reward = m_child[a]->sample(agent, horizon);
+		SearchNode *n = tree.child(*this, a);
+		if (n == NULL)
+			n = &tree.addChild(*this, a, chance);
+		reward = n->sample(agent, tree, horizon);
 	}
 
 	// Update the expected reward and number of visits to the current node.
@@ -98,9 +103,86 @@ reward_t SearchNode::sample(Agent &agent, const int horizon) {
 }
 
 
-SearchNode *SearchNode::child(const interaction_t child_index) const {
-	child_map_t::const_iterator c = m_child.find(child_index);
-	return c == m_child.end() ? NULL : c->second;
+SearchTree::SearchTree(const bool huge_pages) :
+	m_links(1024), m_link_count(0), m_generation(1)
+{
+	m_nodes.useHugePages(huge_pages);
+	m_root = m_nodes.allocate();
+	m_nodes[m_root].m_self = m_root;
+}
+
+
+// The arena forgets its nodes and the table its links without visiting them.
+// Only when the generation wraps around are the old links wiped, as they
+// would otherwise come back.
+void SearchTree::clear(void) {
+	m_nodes.clear();
+	m_root = m_nodes.allocate();
+	m_nodes[m_root].m_self = m_root;
+	m_link_count = 0;
+	if (++m_generation == 0) {
+		m_links.assign(m_links.size(), Link());
+		m_generation = 1;
+	}
+}
+
+
+// Linear probing from a multiplicative hash of the parent and the index.
+size_t SearchTree::findLink(const arena_index_t parent,
+		const interaction_t index) const {
+	const uint64_t key = (uint64_t(parent) << 32) | uint32_t(index);
+	const size_t mask = m_links.size() - 1;
+	size_t slot = size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	while (m_links[slot].generation == m_generation &&
+			(m_links[slot].parent != parent || m_links[slot].index != index)) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+
+void SearchTree::growLinks(void) {
+	std::vector<Link> links(m_links.size() * 2);
+	links.swap(m_links);
+	for (size_t i = 0; i < links.size(); i++) {
+		if (links[i].generation == m_generation)
+			m_links[findLink(links[i].parent, links[i].index)] = links[i];
+	}
+}
+
+
+SearchNode *SearchTree::child(const SearchNode &node,
+		const interaction_t child_index) {
+	const Link &link = m_links[findLink(node.m_self, child_index)];
+	return link.generation == m_generation ? &m_nodes[link.child] : NULL;
+}
+
+
+const SearchNode *SearchTree::child(const SearchNode &node,
+		const interaction_t child_index) const {
+	const Link &link = m_links[findLink(node.m_self, child_index)];
+	return link.generation == m_generation ? &m_nodes[link.child] : NULL;
+}
+
+
+// Slabs never move, so the parent stays where it is while the child is
+// allocated.
+SearchNode &SearchTree::addChild(SearchNode &node,
+		const interaction_t child_index, const nodetype_t nodetype) {
+	assert(child(node, child_index) == NULL);
+	if (2 * (m_link_count + 1) > m_links.size()) growLinks();
+	arena_index_t index = m_nodes.allocate();
+	SearchNode &c = m_nodes[index];
+	c.m_type = nodetype;
+	c.m_self = index;
+
+	Link &link = m_links[findLink(node.m_self, child_index)];
+	link.parent = node.m_self;
+	link.index = child_index;
+	link.child = index;
+	link.generation = m_generation;
+	m_link_count++;
+	return c;
 }
 
 
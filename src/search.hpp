@@ -1,10 +1,13 @@
 #ifndef __SEARCH_HPP__
 #define __SEARCH_HPP__
+#include <vector>
+#include <stdint.h>
+#include "arena.hpp"
 #include "main.hpp"
 
 class Agent;
 
-class SearchNode;
+class SearchTree;
 
 /** Type for storing the number of visits to a node. */
 typedef long long visits_t;
@@ -15,9 +18,6 @@ typedef long long visits_t;
  * chance nodes alternate. */
 enum nodetype_t { chance, decision };
 
-/** Mapping used to store the children of a SearchNode. Indexed by actions or
- * percepts as appropriate. */
-typedef std::map<interaction_t, SearchNode*> child_map_t;
 
 
 
@@ -38,51 +38,49 @@ typedef std::map<interaction_t, SearchNode*> child_map_t;
  *  - The number of times the node has been visited during the sampling
  *    (SearchNode::m_visits, SearchNode::visits()).
  *  - The type of the node (SearchNode::m_type).
- *  - The children of the node (SearchNode::m_child, SearchNode::child()). The
- *    children are stored in a map of type ::child_map_t and are indexed by
- *    actions (decision node) or percepts (chance node).
+ *  - The children of the node (SearchTree::child()), which the tree finds by
+ *    the node and the action (decision node) or percept (chance node) they
+ *    are for.
  *
- * The SearchNode::sample() function is used to sample from the current node and
- * the SearchNode::selectAction() is used to select an action according to the
- * UCB policy. */
+ * The nodes are owned by a ::SearchTree. The SearchNode::sample() function is
+ * used to sample from the current node and the SearchNode::selectAction() is
+ * used to select an action according to the UCB policy. */
 class SearchNode {
 
 public:
 
+	/** Create and initialise a new search node. ::Arena needs a default
+	 * constructor; the node is a decision node. */
+	SearchNode(void);
+
 	/** Create and initialise a new search node of a specific type. */
 	SearchNode(const nodetype_t nodetype);
 
-	/** Destroy all child nodes. */
-	~SearchNode(void);
-
 	/** Determine which action to sample according to the UCB policy.
 	 * \param agent The agent which is doing the sampling.
+	 * \param tree The tree holding this node.
 	 * \return The selected action. */
-	action_t selectAction(Agent const& agent);
+	action_t selectAction(Agent const& agent, const SearchTree &tree) const;
 
 	/** \return The sampled expected reward from this node. */
 	reward_t expectation(void) const { return m_mean; }
 
 	/** Perform a single sample from this node.
 	 * \param agent The agent which is doing the sampling.
+	 * \param tree The tree holding this node, which new children are added to.
 	 * \param horizon How many cycles into the future to sample.
 	 * \return The accumulated reward from this sample. */
-	reward_t sample(Agent &agent, const int horizon );
+	reward_t sample(Agent &agent, SearchTree &tree, const int horizon);
 
 	/** \return The number of times this node has been visited. */
 	visits_t visits(void) const { return m_visits; }
 
-	/** Attempts to access the child node with a certain index.
-	 * \param child_index The index of the child node. This corresponds to an
-	 * action if the node is a decision node or a percept if the node is a
-	 * chance node.
-	 * \return A pointer to the child node if it exists, otherwise return NULL. */
-	SearchNode *child(const interaction_t child_index) const;
-
 private:
-	/** The children of this node. Each corresponds to an action if this is a
-	 * decision node or to a percept if this is a chance node. */
-	child_map_t m_child;
+	friend class SearchTree;
+
+	/** The index of this node in its tree's arena, which identifies it as
+	 * the parent of its children. */
+	arena_index_t m_self;
 
 	/** The type of this node indicates whether it's children represent actions
 	 * (decision node) or percepts (chance node). */
@@ -96,4 +94,97 @@ private:
 };
 
 
+
+/** Owns the nodes of a Monte Carlo search tree in an ::Arena. A search builds
+ * the tree up from its root and then discards the whole of it, so the tree is
+ * released in bulk: SearchTree::clear() hands every node back to the arena at
+ * once, in constant time and without visiting them. The arena keeps its
+ * memory, so later searches allocate nothing until they outgrow the largest
+ * tree so far.
+ *
+ * The children of every node are found through one open-addressed hash table
+ * (SearchTree::m_links), keyed by the parent and the action or percept, so
+ * finding a child takes constant time however many the parent has. A chance
+ * node has a child for every distinct percept sampled from it, which in an
+ * environment with many possible observations can be thousands. The entries
+ * of the table are stamped with the search that made them, so clearing the
+ * tree empties the table without visiting it. */
+class SearchTree {
+public:
+
+	/** Create a tree holding only a root decision node.
+	 * \param huge_pages True to allocate the nodes on huge pages (see
+	 * Arena::useHugePages()). */
+	SearchTree(const bool huge_pages);
+
+	/** Discard every node and start again from a new root decision node. */
+	void clear(void);
+
+	/** \return The root of the tree. */
+	SearchNode &root(void) { return m_nodes[m_root]; }
+	const SearchNode &root(void) const { return m_nodes[m_root]; }
+
+	/** Attempts to access the child node with a certain index.
+	 * \param node The parent node.
+	 * \param child_index The index of the child node. This corresponds to an
+	 * action if the node is a decision node or a percept if the node is a
+	 * chance node.
+	 * \return A pointer to the child node if it exists, otherwise return NULL. */
+	SearchNode *child(const SearchNode &node, const interaction_t child_index);
+	const SearchNode *child(const SearchNode &node,
+		const interaction_t child_index) const;
+
+	/** Add a child to a node which does not have one with its index.
+	 * \param node The parent node.
+	 * \param child_index The index of the child node.
+	 * \param nodetype The type of the child node.
+	 * \return The child node. */
+	SearchNode &addChild(SearchNode &node, const interaction_t child_index,
+		const nodetype_t nodetype);
+
+	/** \return The number of nodes in the tree. */
+	size_t size(void) const { return m_nodes.size(); }
+
+	/** \return True if the nodes are allocated on huge pages. */
+	bool hugePages(void) const { return m_nodes.hugePages(); }
+
+private:
+	/** An entry of SearchTree::m_links: the link from a parent to the child
+	 * for an action or percept. */
+	struct Link {
+		arena_index_t parent;
+		interaction_t index;
+		arena_index_t child;
+
+		/** The SearchTree::m_generation in which the link was made. Links of
+		 * earlier generations are empty slots. */
+		uint32_t generation;
+	};
+
+	/** \return The slot of the link from a node to the child for an index,
+	 * or the empty slot where it would go. */
+	size_t findLink(const arena_index_t parent,
+		const interaction_t index) const;
+
+	/** Double the size of SearchTree::m_links, keeping the current links. */
+	void growLinks(void);
+
+	/** The arena which owns every node in the tree. */
+	Arena<SearchNode> m_nodes;
+
+	/** The index of the root node. */
+	arena_index_t m_root;
+
+	/** The links from parents to children, a power of two in size and at
+	 * most half full. */
+	std::vector<Link> m_links;
+
+	/** The number of links made since the tree was last cleared. */
+	size_t m_link_count;
+
+	/** Counts the clears of the tree, to tell current links from old ones. */
+	uint32_t m_generation;
+};
+
+
 #endif // __SEARCH_HPP__
@@ -0,0 +1,75 @@
+#include <cassert>
+#include "thread_pool.hpp"
+
+
+// Start threads - 1 workers; the caller of run() is the last thread.
+ThreadPool::ThreadPool(const int threads) :
+	m_task(NULL), m_context(NULL), m_count(0), m_next(0), m_remaining(0),
+	m_batch(0), m_stop(false)
+{
+	assert(threads > 0);
+	for (int i = 1; i < threads; i++) {
+		m_workers.push_back(std::thread(&ThreadPool::work, this));
+	}
+}
+
+
+// Stop and join the workers.
+ThreadPool::~ThreadPool(void) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		m_workers[i].join();
+	}
+}
+
+
+// Run a batch of tasks on the workers and the calling thread.
+void ThreadPool::run(task_t task, void *context, const int count) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	assert(m_remaining == 0);
+	m_task = task;
+	m_context = context;
+	m_count = count;
+	m_next = 0;
+	m_remaining = count;
+	m_batch++;
+	m_start.notify_all();
+
+	runTasks(lock);
+	while (m_remaining > 0) {
+		m_done.wait(lock);
+	}
+}
+
+
+// Wait for batches and help to run them.
+void ThreadPool::work(void) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	unsigned long batch = m_batch;
+	for (;;) {
+		while (!m_stop && m_batch == batch) {
+			m_start.wait(lock);
+		}
+		if (m_stop) return;
+		batch = m_batch;
+		runTasks(lock);
+	}
+}
+
+
+// Take tasks from the current batch until they have all been started.
+void ThreadPool::runTasks(std::unique_lock<std::mutex> &lock) {
+	while (m_next < m_count) {
+		int index = m_next++;
+		lock.unlock();
+		m_task(m_context, index);
+		lock.lock();
+		if (--m_remaining == 0) {
+			m_done.notify_all();
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A ::ThreadPool runs batches of independent tasks on a fixed set of worker
+ * threads. A batch is a function applied to each index in a range; the thread
+ * calling ThreadPool::run() works on the batch too and returns once every task
+ * has finished, so a pool of n threads starts n - 1 workers. */
+class ThreadPool {
+public:
+
+	/** A task: called once with each index of the batch.
+	 * \param context The pointer passed to ThreadPool::run().
+	 * \param index The index of the task within the batch. */
+	typedef void (*task_t)(void *context, const int index);
+
+
+	/** Start the workers.
+	 * \param threads The number of threads which run each batch, including
+	 * the caller of ThreadPool::run(). */
+	ThreadPool(const int threads);
+
+
+	/** Stop and join the workers. */
+	~ThreadPool(void);
+
+
+	/** Run a batch of tasks and wait for all of them to finish.
+	 * \param task The function to call for each index.
+	 * \param context Passed to every call of the task.
+	 * \param count The number of tasks, with indices 0 to count - 1. */
+	void run(task_t task, void *context, const int count);
+
+
+	/** \return The number of threads which run each batch. */
+	int threads(void) const { return int(m_workers.size()) + 1; }
+
+private:
+
+	/** The loop run by each worker thread. */
+	void work(void);
+
+	/** Run tasks from the current batch until none are left to start.
+	 * Expects ThreadPool::m_mutex to be held by the lock, which is released
+	 * while each task runs. */
+	void runTasks(std::unique_lock<std::mutex> &lock);
+
+	/** The worker threads. */
+	std::vector<std::thread> m_workers;
+
+	/** Guards the members below. */
+	std::mutex m_mutex;
+
+	/** Signalled when a batch starts or the pool is stopped. */
+	std::condition_variable m_start;
+
+	/** Signalled when the last task of a batch finishes. */
+	std::condition_variable m_done;
+
+	/** The current batch. */
+	task_t m_task;
+	void *m_context;
+	int m_count;
+
+	/** The index of the next task to start. */
+	int m_next;
+
+	/** The number of tasks of the current batch which have not finished. */
+	int m_remaining;
+
+	/** Incremented for each batch, so that workers can tell batches apart. */
+	unsigned long m_batch;
+
+	/** Set when the workers should exit. */
+	bool m_stop;
+
+	// Thread pools own their threads and cannot be copied.
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
+
+#endif // __THREAD_POOL_HPP__
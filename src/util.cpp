@@ -12,9 +12,41 @@ int bitsRequired(const int x) {
 }
 
 
+// The generator used by the calling thread instead of rand(), if any.
+static thread_local random_state_t *thread_random_state = NULL;
+
+
+// The splitmix64 generator: each step adds a constant to the state, and the
+// output is a mix of the state's bits.
+static uint64_t nextRandom(random_state_t &state) {
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+
+random_state_t seedRandomState(const unsigned int seed, const int stream) {
+	random_state_t state = (uint64_t(seed) << 32) | uint32_t(stream);
+	return nextRandom(state);
+}
+
+
+void useRandomState(random_state_t *state) {
+	thread_random_state = state;
+}
+
+
+// An integer between [0, RAND_MAX], from rand() or the thread's generator
+static int randInt() {
+	if (thread_random_state == NULL) return rand();
+	return int(nextRandom(*thread_random_state) % (uint64_t(RAND_MAX) + 1));
+}
+
+
 // Return a number uniformly between [0, 1]
 double rand01() {
-	return double(rand()) / double(RAND_MAX);
+	return double(randInt()) / double(RAND_MAX);
 }
 
 
@@ -23,9 +55,9 @@ int randRange(int end) {
 	assert(0 <= end && end <= RAND_MAX);
 
 	// Generate an integer between [0, end) uniformly using rejection sampling.
-	int r = rand();
+	int r = randInt();
 	const int remainder = RAND_MAX % end;
-	while (r < remainder) r = rand();
+	while (r < remainder) r = randInt();
 	return r % end;
 }
 
@@ -2,12 +2,33 @@
 #define __UTIL_HPP__
 #include <sstream>
 #include <string>
+#include <stdint.h>
 #include "main.hpp"
 
 
 /** Calculate the number of bits needed to store x >= 0. */
 int bitsRequired(const int x);
 
+/** The state of a pseudo-random number generator which is independent of
+ * rand(), for a thread which must not share its sequence (see
+ * useRandomState()). */
+typedef uint64_t random_state_t;
+
+/** Seed a generator. Generators seeded with the same seed and different
+ * streams give unrelated sequences.
+ * \param seed The seed, such as the "random-seed" option.
+ * \param stream The number of the sequence, such as the index of a thread.
+ * \return The state of the generator. */
+random_state_t seedRandomState(const unsigned int seed, const int stream);
+
+/** Choose where rand01() and randRange() on the calling thread draw their
+ * numbers from. By default they use rand(), whose state is shared by every
+ * thread and guarded by a lock, so threads which draw numbers at the same
+ * time slow each other down and take them in an unpredictable order.
+ * \param state The generator to use, which must outlive its use, or NULL to
+ * use rand() again. */
+void useRandomState(random_state_t *state);
+
 /** Sample a number from the unit interval uniformly at random.
  * \return A random double between 0 and 1. */
 double rand01();
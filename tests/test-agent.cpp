@@ -0,0 +1,97 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../src/search.hpp"
+
+// Unit tests for the search tree. Each test prints a line for every check
+// that fails; the program exits with failure if any did.
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &test,
+		const std::string &what) {
+	if (ok) return;
+	std::cerr << "FAILED: " << test << ": " << what << std::endl;
+	failures++;
+}
+
+
+// Each child is found by its parent and index, also once a chance node has
+// far more children than the link table first holds and the table has grown.
+// Nodes with the same index under different parents are distinct.
+static void testChildren(void) {
+	const std::string test = "search tree children";
+	SearchTree tree(false);
+	SearchNode &root = tree.root();
+	SearchNode &parent = tree.addChild(root, 3, chance);
+	std::vector<SearchNode *> children;
+	for (interaction_t percept = 0; percept < 3000; percept++) {
+		children.push_back(&tree.addChild(parent, percept * 7, decision));
+	}
+	SearchNode &other = tree.addChild(root, 4, chance);
+	SearchNode &cousin = tree.addChild(other, 7, decision);
+	check(tree.size() == 3004, test, "size");
+
+	bool found = true, missing = true;
+	for (interaction_t percept = 0; percept < 3000; percept++) {
+		if (tree.child(parent, percept * 7) != children[percept])
+			found = false;
+		if (tree.child(parent, percept * 7 + 1) != NULL) missing = false;
+	}
+	check(found, test, "child not found");
+	check(missing, test, "child which was never added found");
+	check(tree.child(root, 3) == &parent && tree.child(root, 4) == &other,
+		test, "root children");
+	check(tree.child(other, 7) == &cousin && &cousin != children[1], test,
+		"same index under another parent");
+	check(tree.child(other, 14) == NULL, test, "child of another parent");
+}
+
+
+// Clearing the tree empties the link table without visiting it: the links of
+// earlier searches are not found, although the new nodes reuse the indices
+// of the old ones, and new links are found.
+static void testClear(void) {
+	const std::string test = "search tree clear";
+	SearchTree tree(false);
+	for (int search = 0; search < 50; search++) {
+		const interaction_t children = 10 + 97 * (search % 11);
+		SearchNode &root = tree.root();
+		bool stale = false;
+		for (interaction_t action = 0; action < 1200; action++) {
+			if (tree.child(root, action) != NULL) stale = true;
+		}
+		check(stale == false, test, "link of an earlier search found");
+
+		std::vector<SearchNode *> added;
+		for (interaction_t action = 0; action < children; action++) {
+			SearchNode &child = tree.addChild(root, action, chance);
+			added.push_back(&child);
+			tree.addChild(child, action, decision);
+		}
+		check(tree.size() == 1 + 2 * size_t(children), test, "size");
+		bool found = true;
+		for (interaction_t action = 0; action < children; action++) {
+			SearchNode *child = tree.child(root, action);
+			if (child != added[action] || tree.child(*child, action) == NULL)
+				found = false;
+		}
+		check(found, test, "child not found");
+		tree.clear();
+		check(tree.size() == 1, test, "size after clear");
+	}
+}
+
+
+int main(void) {
+	testChildren();
+	testClear();
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "All tests passed" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,701 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../src/history.hpp"
+#include "../src/model_file.hpp"
+#include "../src/predict.hpp"
+#include "../src/util.hpp"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Unit tests for the context trees. Each test prints a line for every check
+// that fails; the program exits with failure if any did.
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &test,
+		const std::string &what) {
+	if (ok) return;
+	std::cerr << "FAILED: " << test << ": " << what << std::endl;
+	failures++;
+}
+
+// A repetitive symbol sequence with some noise, which grows a tree of some
+// depth without filling it.
+static symbol_t testSymbol(const int t) {
+	return (t % 5 == 0) != (rand() % 7 == 0);
+}
+
+static ContextTree *createTree(const int depth, const std::string &format,
+		const std::string &max_nodes = "0",
+		const std::string &model = "single") {
+	options_t options;
+	options["ct-depth"] = toString(depth);
+	options["ct-node-format"] = format;
+	options["ct-max-nodes"] = max_nodes;
+	options["ct-model"] = model;
+	return ContextTree::create(options, 64, 8);
+}
+
+static ContextTree *createTree(options_t options) {
+	return ContextTree::create(options, 64, 8);
+}
+
+static ContextTree *loadTree(const std::string &path) {
+	options_t options;
+	options["ct-depth"] = "1";
+	options["load-model"] = path;
+	return ContextTree::create(options, 64, 8);
+}
+
+// Overwrite part of a file.
+static void patchFile(const std::string &path, const size_t offset,
+		const void *data, const size_t bytes) {
+	std::fstream file(path.c_str(),
+		std::ios::in | std::ios::out | std::ios::binary);
+	file.seekp(std::streamoff(offset));
+	file.write(static_cast<const char *>(data), std::streamsize(bytes));
+}
+
+
+// An overlay predicts what the shared tree would if it were updated in
+// place, leaves the shared tree untouched, and returns to it when cleared,
+// also after the shared tree has changed.
+static void testOverlay(const std::string &format) {
+	const std::string test = "overlay (" + format + ")";
+	srand(1);
+	ContextTree *base = createTree(12, format);
+	ContextTree *copy = createTree(12, format);
+	ContextTree *overlay = base->createOverlay();
+	check(overlay != NULL, test, "no overlay");
+	if (overlay == NULL) return;
+
+	for (int cycle = 0; cycle < 40; cycle++) {
+		for (int t = 0; t < 50; t++) {
+			const symbol_t symbol = testSymbol(t);
+			base->update(symbol);
+			copy->update(symbol);
+		}
+		const double log_base = base->logBlockProbability();
+		const size_t size = base->size();
+
+		// Simulate twice from the same state, as the search does.
+		for (int simulation = 0; simulation < 2; simulation++) {
+			overlay->clear();
+			check(overlay->historySize() == base->historySize(), test,
+				"history size after clear");
+			check(overlay->logBlockProbability() == log_base, test,
+				"block probability after clear");
+			for (int t = 0; t < 30; t++) {
+				const symbol_t symbol = testSymbol(t);
+				check(overlay->predict(symbol) == copy->predict(symbol), test,
+					"prediction");
+				overlay->update(symbol);
+				copy->update(symbol);
+			}
+			check(overlay->logBlockProbability() ==
+				copy->logBlockProbability(), test, "block probability");
+			check(overlay->size() == copy->size(), test, "size");
+			overlay->revert(10);
+			copy->revert(10);
+			check(overlay->logBlockProbability() ==
+				copy->logBlockProbability(), test, "block probability after "
+				"revert");
+			copy->revert(20);
+		}
+		check(base->logBlockProbability() == log_base &&
+			base->size() == size, test, "shared tree changed");
+		check(copy->logBlockProbability() == log_base, test,
+			"in-place tree not reverted");
+	}
+	delete overlay;
+	delete copy;
+	delete base;
+}
+
+
+// A saved tree, pruned or not, loads as the same tree: it predicts the same
+// and goes on learning the same.
+static void testSaveLoad(const std::string &format, const int depth,
+		const std::string &max_nodes) {
+	const std::string test = "save and load (" + format + ", depth " +
+		toString(depth) + ", max nodes " + max_nodes + ")";
+	const std::string path = "test-predict.ctw";
+	srand(2);
+	ContextTree *tree = createTree(depth, format, max_nodes);
+	for (int t = 0; t < 20000; t++) {
+		tree->update(testSymbol(t));
+		tree->prune();
+	}
+	check(tree->save(path), test, "save failed");
+	ContextTree *loaded = loadTree(path);
+	check(loaded->depth() == tree->depth(), test, "depth");
+	check(loaded->size() == tree->size(), test, "size");
+	check(loaded->logBlockProbability() == tree->logBlockProbability(), test,
+		"block probability");
+
+	for (int t = 0; t < 5000; t++) {
+		const symbol_t symbol = testSymbol(t);
+		check(loaded->predict(symbol) == tree->predict(symbol), test,
+			"prediction");
+		tree->update(symbol);
+		loaded->update(symbol);
+		if (t % 500 == 499) {
+			tree->revert(3);
+			loaded->revert(3);
+			check(loaded->logBlockProbability() ==
+				tree->logBlockProbability(), test, "block probability after "
+				"revert");
+		}
+	}
+	check(loaded->size() == tree->size(), test, "size after updates");
+	delete loaded;
+	delete tree;
+	std::remove(path.c_str());
+}
+
+
+static options_t nodeCountOptions(const std::string &backend,
+		const std::string &format, const std::string &expand,
+		const std::string &revert) {
+	options_t options;
+	options["ct-backend"] = backend;
+	options["ct-node-format"] = format;
+	options["ct-expand"] = expand;
+	options["ct-revert"] = revert;
+	return options;
+}
+
+
+// The node counts kept by depth as the tree changes add up to its size, and
+// match a recount of the nodes: loading a saved model counts them afresh.
+// Nodes are created and released by updates, reverts, splitting chains and
+// pruning; a hashed tree, which cannot be saved, also replaces them.
+static void testNodeCounts(options_t options) {
+	const std::string test = "node counts (" + options["ct-backend"] + ", " +
+		options["ct-node-format"] + ", " + options["ct-expand"] + ", " +
+		options["ct-revert"] + ")";
+	const std::string path = "test-predict.ctw";
+	srand(12);
+	options["ct-depth"] = "24";
+	options["ct-max-nodes"] = "3000";
+	ContextTree *tree = createTree(options);
+	const bool hashed = options["ct-backend"] == "hashed";
+
+	for (int t = 0; t < 6000; t++) {
+		tree->update(testSymbol(t));
+		if (t % 50 == 49) {
+			const int symbols = 1 + rand() % 80;
+			for (int i = 0; i < symbols; i++) tree->update(rand() % 3 == 0);
+			tree->revert(symbols);
+		}
+		if (t % 500 != 499) continue;
+		tree->prune();
+
+		size_t total = 0;
+		for (int level = 0; level <= 24; level++) {
+			total += tree->levelSize(level);
+		}
+		check(total == tree->size(), test, "levels do not add up");
+		check(tree->nodesCreated() - tree->nodesReleased() == tree->size(),
+			test, "created less released");
+		if (hashed) continue;
+
+		check(tree->save(path), test, "save failed");
+		ContextTree *loaded = loadTree(path);
+		bool levels_ok = loaded->size() == tree->size();
+		for (int level = 0; level <= 24; level++) {
+			if (loaded->levelSize(level) != tree->levelSize(level))
+				levels_ok = false;
+		}
+		check(levels_ok, test, "recount");
+		delete loaded;
+	}
+	delete tree;
+	std::remove(path.c_str());
+}
+
+
+#ifndef _WIN32
+// Loading a corrupt model exits, so it is done in a child process.
+static bool loadFails(const std::string &path) {
+	std::cerr.flush();
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (std::freopen("/dev/null", "w", stderr) == NULL) _exit(2);
+		loadTree(path);
+		_exit(EXIT_SUCCESS);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE;
+}
+#endif
+
+
+// Check that a patched header is rejected when the file is opened, then undo
+// the patch.
+static void checkHeaderRejected(const std::string &path,
+		const ModelHeader &patched, const ModelHeader &header,
+		const std::string &test, const std::string &what) {
+	patchFile(path, 0, &patched, sizeof(patched));
+	std::string error;
+	ModelFile *model = ModelFile::open(path, error);
+	check(model == NULL && error == "invalid header", test, what);
+	delete model;
+	patchFile(path, 0, &header, sizeof(header));
+}
+
+
+// A file whose header does not describe a usable model is rejected when it
+// is opened, and one whose nodes do not form a tree when it is loaded.
+static void testCorruptModel(void) {
+	const std::string test = "corrupt model";
+	const std::string path = "test-predict.ctw";
+	ContextTree *tree = createTree(8, "standard");
+	for (int t = 0; t < 2000; t++) tree->update(testSymbol(t));
+	check(tree->save(path), test, "save failed");
+	delete tree;
+
+	std::string error;
+	ModelFile *model = ModelFile::open(path, error);
+	check(model != NULL, test, "intact file rejected: " + error);
+	if (model == NULL) return;
+	ModelHeader header = model->header();
+	delete model;
+
+	// Too many nodes to link by index. The file is also too short for them.
+	ModelHeader patched = header;
+	patched.node_count = uint64_t(1) << 33;
+	checkHeaderRejected(path, patched, header, test,
+		"node count beyond the index range accepted");
+
+	// Deeper than an int, or than the saved history.
+	patched = header;
+	patched.depth = 0x80000000u;
+	checkHeaderRejected(path, patched, header, test,
+		"depth beyond the int range accepted");
+	patched.depth = header.depth + 1;
+	checkHeaderRejected(path, patched, header, test,
+		"depth beyond the saved history accepted");
+
+#ifndef _WIN32
+	// The child links are the last two words of a standard node. Linking
+	// the root to its first child twice reaches that child twice and never
+	// reaches the second.
+	const size_t root_offset = size_t(header.nodes_offset + header.root *
+		header.node_bytes);
+	const size_t links_offset = root_offset + header.node_bytes -
+		2 * sizeof(arena_index_t);
+	arena_index_t links[2] = { 0, 0 };
+	std::ifstream in(path.c_str(), std::ios::binary);
+	in.seekg(std::streamoff(links_offset));
+	in.read(reinterpret_cast<char *>(links), sizeof(links));
+	in.close();
+	check(links[0] != null_index && links[1] != null_index, test,
+		"root has only one child");
+	const arena_index_t duplicate[2] = { links[0], links[0] };
+	patchFile(path, links_offset, duplicate, sizeof(duplicate));
+	check(loadFails(path), test, "child linked twice accepted");
+	patchFile(path, links_offset, links, sizeof(links));
+	check(!loadFails(path), test, "restored links rejected");
+
+	// A root whose links lead outside the file.
+	std::vector<char> garbage(header.node_bytes, 0x7F);
+	patchFile(path, root_offset, &garbage[0], garbage.size());
+	check(loadFails(path), test, "links outside the file accepted");
+#endif
+	std::remove(path.c_str());
+}
+
+
+static bool moreProbableSequence(const SequencePrediction &a,
+		const SequencePrediction &b) {
+	return a.probability > b.probability;
+}
+
+
+// Every sequence is listed, the probabilities sum to one, and the most
+// probable come first with a limit. Each probability is that of predicting
+// the sequence in full, and the tree is left as it was.
+static void testSequences(const std::string &model) {
+	const std::string test = "predict sequences (" + model + ")";
+	srand(4);
+	ContextTree *tree = createTree(16, "standard", "0", model);
+	for (int t = 0; t < 4000; t++) {
+		if (t % 8 == 0) tree->updateHistory(symbol_list_t(2, rand() % 2));
+		tree->update(testSymbol(t));
+	}
+	tree->updateHistory(symbol_list_t(2, 1));
+	const size_t history = tree->historySize();
+	const size_t size = tree->size();
+	const double log_block = tree->logBlockProbability();
+
+	std::vector<SequencePrediction> all;
+	tree->predictSequences(8, all);
+	check(all.size() == 256, test, "sequence count");
+	double total = 0.0;
+	for (size_t i = 0; i < all.size(); i++) {
+		check(all[i].sequence == i, test, "order");
+		total += all[i].probability;
+		symbol_list_t symbols;
+		for (int b = 0; b < 8; b++) symbols.push_back((i >> b) & 1);
+		const double expected = tree->predict(symbols);
+		check(std::fabs(all[i].probability - expected) <= 1e-9 * expected,
+			test, "probability of sequence " + toString(i));
+	}
+	check(std::fabs(total - 1.0) < 1e-9, test, "probabilities sum to one");
+
+	std::vector<SequencePrediction> best;
+	tree->predictSequences(8, best, 5);
+	std::vector<SequencePrediction> sorted = all;
+	std::sort(sorted.begin(), sorted.end(), moreProbableSequence);
+	check(best.size() == 5, test, "limited count");
+	for (size_t i = 0; i < best.size() && i < 5; i++) {
+		check(best[i].probability == sorted[i].probability, test,
+			"most probable sequence " + toString(i));
+	}
+
+	check(tree->historySize() == history && tree->size() == size &&
+		tree->logBlockProbability() == log_block, test, "tree changed");
+	delete tree;
+}
+
+
+// A factored tree updated with whole percepts spreads the trees over its
+// thread pool. It learns exactly what a tree without threads does when
+// updated one bit at a time, and reverting a whole percept on the pool
+// undoes an update.
+static void testFactoredThreads(void) {
+	const std::string test = "factored update on threads";
+	srand(5);
+	options_t options;
+	options["ct-depth"] = "10";
+	options["ct-model"] = "factored";
+	options["ct-threads"] = "4";
+	ContextTree *pooled = createTree(options);
+	options["ct-threads"] = "1";
+	ContextTree *serial = createTree(options);
+
+	for (int cycle = 0; cycle < 300; cycle++) {
+		const symbol_list_t action(2, rand() % 2);
+		pooled->updateHistory(action);
+		serial->updateHistory(action);
+		symbol_list_t percept;
+		for (int b = 0; b < 8; b++) percept.push_back(testSymbol(cycle + b));
+		check(pooled->predict(percept) == serial->predict(percept), test,
+			"percept prediction");
+
+		const double log_before = pooled->logBlockProbability();
+		pooled->update(percept);
+		for (int b = 0; b < 8; b++) serial->update(percept[b]);
+		check(pooled->logBlockProbability() == serial->logBlockProbability(),
+			test, "block probability");
+		if (cycle % 50 == 49) {
+			pooled->revert(8);
+			for (int b = 0; b < 8; b++) serial->revert();
+			check(pooled->logBlockProbability() == log_before &&
+				serial->logBlockProbability() == log_before, test,
+				"revert of a whole percept");
+			pooled->update(percept);
+			serial->update(percept);
+		}
+	}
+	check(pooled->size() == serial->size(), test, "size");
+	delete pooled;
+	delete serial;
+}
+
+
+// A journaled revert copies the nodes back, so for as many symbols as the
+// journal holds it returns the tree exactly to its state before the updates.
+// Recomputing undoes the arithmetic, to within rounding. Both release the
+// nodes the updates created.
+static void testJournal(const std::string &format, const std::string &expand) {
+	const std::string test = "journaled revert (" + format + ", " + expand +
+		")";
+	srand(6);
+	options_t options;
+	options["ct-depth"] = "20";
+	options["ct-node-format"] = format;
+	options["ct-expand"] = expand;
+	ContextTree *reference = createTree(options);
+	ContextTree *journaled = createTree(options);
+	options["ct-revert"] = "recompute";
+	ContextTree *recomputed = createTree(options);
+
+	for (int t = 0; t < 3000; t++) {
+		const symbol_t symbol = testSymbol(t);
+		reference->update(symbol);
+		journaled->update(symbol);
+		recomputed->update(symbol);
+		if (t % 100 != 99) continue;
+
+		// The journal holds the last 64 updates; older ones are recomputed.
+		const int symbols = 1 + rand() % 80;
+		for (int i = 0; i < symbols; i++) {
+			const symbol_t simulated = rand() % 3 == 0;
+			journaled->update(simulated);
+			recomputed->update(simulated);
+		}
+		journaled->revert(symbols);
+		recomputed->revert(symbols);
+		const double log_block = reference->logBlockProbability();
+		if (symbols <= 64) {
+			check(journaled->logBlockProbability() == log_block &&
+				journaled->predict(true) == reference->predict(true), test,
+				"journal not exact");
+		}
+		check(std::fabs(journaled->logBlockProbability() - log_block) <=
+			1e-9 * std::fabs(log_block), test, "journal");
+		check(std::fabs(recomputed->logBlockProbability() - log_block) <=
+			1e-9 * std::fabs(log_block), test, "recompute");
+		check(journaled->size() == reference->size() &&
+			recomputed->size() == reference->size(), test, "size");
+	}
+	delete recomputed;
+	delete journaled;
+	delete reference;
+}
+
+
+// Pruning keeps the tree within its byte budget, leaves its predictions a
+// probability distribution and keeps the weighted probabilities consistent.
+// A deep tree has long paths to release.
+static void testPrune(const std::string &format, const int depth) {
+	const std::string test = "prune (" + format + ", depth " +
+		toString(depth) + ")";
+	srand(7);
+	const size_t max_bytes = 2000;
+	options_t options;
+	options["ct-depth"] = toString(depth);
+	options["ct-node-format"] = format;
+	options["ct-max-bytes"] = toString(max_bytes);
+	options["ct-revert"] = "recompute";
+	ContextTree *tree = createTree(options);
+
+	size_t pruned = 0;
+	for (int t = 0; t < 2000; t++) {
+		tree->update(testSymbol(t));
+		if (t % 100 != 99) continue;
+		pruned += tree->prune();
+		check(tree->nodeBytes() <= max_bytes, test, "over budget");
+		const double total = tree->predict(false) + tree->predict(true);
+		check(std::fabs(total - 1.0) <= 1e-9, test, "not normalised");
+
+		// The weighted probabilities above the pruned nodes were recomputed,
+		// so recomputing those on a path, as a revert without the journal
+		// does, leaves them unchanged.
+		const double log_block = tree->logBlockProbability();
+		tree->update(false);
+		tree->revert();
+		check(std::fabs(tree->logBlockProbability() - log_block) <=
+			1e-9 * std::fabs(log_block), test, "stale weights");
+	}
+	check(pruned > 0, test, "nothing pruned");
+	delete tree;
+}
+
+
+// A selected context reads the chosen symbols of the history, also as the
+// history wraps around its buffer and symbols are removed. Runs of consecutive
+// ages longer than a word or across a word of the context, repeated ages and
+// ages out of order are included.
+static void testSelectContext(void) {
+	const std::string test = "selected context";
+	srand(11);
+	std::vector<size_t> ages;
+	for (size_t age = 0; age < 40; age++) ages.push_back(age);
+	for (size_t age = 100; age < 170; age++) ages.push_back(age);
+	ages.push_back(5);
+	ages.push_back(5);
+	ages.push_back(300);
+	const size_t span = 301;
+
+	History history(ages.size());
+	history.selectContext(ages);
+	std::vector<symbol_t> symbols;
+	for (int t = 0; t < 3000; t++) {
+		const symbol_t symbol = rand() % 2 == 0;
+		history.push_back(symbol);
+		symbols.push_back(symbol);
+		if (t % 7 == 6) {
+			for (int i = rand() % 3; i > 0; i--) {
+				history.pop_back();
+				symbols.pop_back();
+			}
+		}
+		if (symbols.size() < span) continue;
+
+		bool symbols_ok = true, words_ok = true;
+		for (size_t position = 0; position < ages.size(); position++) {
+			const symbol_t expected = symbols[symbols.size() - 1 -
+				ages[position]];
+			if (history.contextSymbol(position) != expected)
+				symbols_ok = false;
+			const uint64_t word = history.context(position);
+			for (size_t j = 0; j < 64; j++) {
+				const symbol_t bit = position + j < ages.size() &&
+					symbols[symbols.size() - 1 - ages[position + j]];
+				if (((word >> j) & 1) != uint64_t(bit)) words_ok = false;
+			}
+		}
+		check(symbols_ok, test, "context symbol");
+		check(words_ok, test, "context word");
+	}
+}
+
+
+// A lazy tree keeps unshared paths as chain nodes, and splits them as
+// contexts diverge, but predicts what an eager tree does. A revert which
+// recomputes joins the split chains again. Beyond Node::cChainLevels from the
+// maximum depth nodes are created eagerly in both.
+static void testLazy(const std::string &format, const int depth) {
+	const std::string test = "lazy expansion (" + format + ", depth " +
+		toString(depth) + ")";
+	srand(10);
+	options_t options;
+	options["ct-depth"] = toString(depth);
+	options["ct-node-format"] = format;
+	ContextTree *eager = createTree(options);
+	options["ct-expand"] = "lazy";
+	options["ct-revert"] = "recompute";
+	ContextTree *lazy = createTree(options);
+
+	for (int t = 0; t < 3000; t++) {
+		const symbol_t symbol = testSymbol(t);
+		eager->update(symbol);
+		lazy->update(symbol);
+		const double log_block = eager->logBlockProbability();
+		check(std::fabs(lazy->logBlockProbability() - log_block) <=
+			1e-9 * std::fabs(log_block), test, "block probability");
+		check(std::fabs(lazy->predict(true) - eager->predict(true)) <= 1e-9,
+			test, "prediction");
+		check(lazy->size() <= eager->size(), test, "more nodes than eager");
+		if (t % 100 != 99) continue;
+
+		const size_t size = lazy->size();
+		const double prediction = lazy->predict(true);
+		const int symbols = 1 + rand() % 20;
+		for (int i = 0; i < symbols; i++) lazy->update(rand() % 3 == 0);
+		lazy->revert(symbols);
+		check(lazy->size() == size, test, "split chains not joined");
+		check(std::fabs(lazy->predict(true) - prediction) <= 1e-9, test,
+			"revert");
+	}
+	check(lazy->size() < eager->size(), test, "no chains");
+	delete lazy;
+	delete eager;
+}
+
+
+// Without replacements a hashed tree computes what an arena tree of standard
+// nodes does. Its predictions are summed in a different order, so they agree
+// only to within rounding.
+static void testHashedExact(void) {
+	const std::string test = "hashed tree (large table)";
+	srand(8);
+	options_t options;
+	options["ct-depth"] = "12";
+	ContextTree *arena = createTree(options);
+	options["ct-backend"] = "hashed";
+	options["ct-max-nodes"] = "65536";
+	ContextTree *hashed = createTree(options);
+
+	for (int t = 0; t < 3000; t++) {
+		const symbol_t symbol = testSymbol(t);
+		arena->update(symbol);
+		hashed->update(symbol);
+		check(hashed->logBlockProbability() == arena->logBlockProbability(),
+			test, "block probability");
+		check(std::fabs(hashed->predict(true) - arena->predict(true)) <=
+			1e-12, test, "prediction");
+
+		// The table holds no root until the history holds a context.
+		if (t >= 12)
+			check(hashed->size() == arena->size(), test, "size");
+	}
+	delete hashed;
+	delete arena;
+}
+
+
+// A table too small for the tree replaces entries, but never one on the path
+// being updated, and a journaled revert brings back the entries the reverted
+// updates replaced.
+static void testHashedReplacement(void) {
+	const std::string test = "hashed tree (small table)";
+	srand(9);
+	options_t options;
+	options["ct-depth"] = "12";
+	options["ct-backend"] = "hashed";
+	options["ct-max-nodes"] = "64";
+	ContextTree *hashed = createTree(options);
+
+	for (int t = 0; t < 3000; t++) {
+		hashed->update(testSymbol(t));
+		check(hashed->size() <= 64, test, "more entries than the table");
+		const double total = hashed->predict(false) + hashed->predict(true);
+		check(std::fabs(total - 1.0) <= 1e-9, test, "not normalised");
+		if (t % 100 != 99) continue;
+
+		const double log_block = hashed->logBlockProbability();
+		const double prediction = hashed->predict(true);
+		const size_t size = hashed->size();
+		const int symbols = 1 + rand() % 40;
+		for (int i = 0; i < symbols; i++) hashed->update(rand() % 3 == 0);
+		hashed->revert(symbols);
+		check(hashed->logBlockProbability() == log_block &&
+			hashed->predict(true) == prediction, test, "revert not exact");
+		check(hashed->size() == size, test, "revert size");
+	}
+	delete hashed;
+}
+
+
+int main(void) {
+	testOverlay("standard");
+	testOverlay("compact");
+	testSaveLoad("standard", 5, "0");
+	testSaveLoad("standard", 70, "5000");
+	testSaveLoad("compact", 70, "0");
+	testSaveLoad("compact", 5, "100");
+	testNodeCounts(nodeCountOptions("arena", "standard", "eager", "journal"));
+	testNodeCounts(nodeCountOptions("arena", "compact", "lazy", "recompute"));
+	testNodeCounts(nodeCountOptions("arena", "compact", "lazy", "journal"));
+	testNodeCounts(nodeCountOptions("hashed", "standard", "eager", "journal"));
+	testCorruptModel();
+	testSequences("single");
+	testSequences("factored");
+	testFactoredThreads();
+	testJournal("standard", "eager");
+	testJournal("compact", "eager");
+	testJournal("standard", "lazy");
+	testJournal("compact", "lazy");
+	testJournal("compact-float", "lazy");
+	testPrune("standard", 30);
+	testPrune("compact", 30);
+	testPrune("standard", 1000);
+	testSelectContext();
+	testLazy("standard", 30);
+	testLazy("compact", 30);
+	testLazy("count-only", 40);
+	testLazy("standard", 120);
+	testHashedExact();
+	testHashedReplacement();
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "All tests passed" << std::endl;
+	return EXIT_SUCCESS;
+}